@@ -62,11 +62,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "carnival.h"
 #include "trickmath.h"
+#include "rng.h"
+#include "replay.h"
+#include "golden.h"
 #include "level.h"
 
 
@@ -79,7 +85,26 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/* Simulation steps per second. Rendering runs at its own rate
+ * (-f) and interpolates between the last two steps.
+ */
 #define FPS 60
+#define TICK_NS (1000000000LL / FPS)
+/* Drop simulation time when more than this many steps behind */
+#define MAX_TICKS_BEHIND 10
+/* Default max frames in a row not drawn when behind (-s) */
+#define MAX_FRAME_SKIP 4
+
+/* Start loading next level in the background when this
+ * many seconds are left of the current level.
+ */
+#define PRELOAD_TIME_LEFT 10
+/* Max decoded image memory of a preloaded level, 0 = no limit */
+#define PRELOAD_MAX_BYTES (32 * 1024 * 1024)
+
+/* Levels are read from this file in the level directory if there
+ * are no loose level files */
+#define LEVEL_PACK "levels.pak"
 
 /* Use 256 "degree" circle */
 #define deg2rad(x) (2 * M_PI * (x) / 256.0f)
@@ -120,28 +145,217 @@ struct spritestruct_t {
    char *png;
 };
 
+/* Queued mouse click */
+#define MAX_CLICKS 64
+struct click_t {
+   int x, y;
+   /* When it was made, ns */
+   long long t;
+};
+
+
+/* One random stream per use, so e.g. a new way of picking score
+ * angles doesn't change where targets spawn for the same seed. */
+enum random_t {
+   Random_spawn,
+   Random_place,
+   Random_flag,
+   Random_score,
+   NUM_RANDOM
+};
+
+/* Where a shot ended up */
+enum ring_t {
+   Ring_inner,
+   Ring_middle,
+   Ring_outer,
+   /* Animal hit outside the target circle */
+   Ring_body,
+   Ring_miss,
+   NUM_RINGS
+};
+
+/* What the games of a batch run (-B) did in one level, summed */
+struct level_stats_t {
+   unsigned int played;
+   unsigned int spawns[NUM_TARGETS];
+   unsigned int shots[NUM_RINGS];
+   unsigned int bonus_hits;
+};
+
+/* Hardcode params for waves */
+#define WAVE_X 63
+#define WAVE_Y 445
+#define WAVE_AMP_X (68 / 2)
+#define WAVE_AMP_Y (20 / 2)
+#define WAVE_SPACING 25
+#define WAVES 5
+#define NUM_WAVES 2
+
+/* Everything a game changes while it is played. Games only share
+ * the sprites below that they don't change, so any number of them
+ * can run side by side.
+ */
+struct game_t {
+   /* Played in the window: gets the input, records and plays back
+    * replays, preloads levels and changes the cursor */
+   bool primary;
+   /* Level being played and its number */
+   struct level_t *lv;
+   int level;
+   /* When not primary, levels by number - 1. Loaded once by the
+    * caller and played again by each game, NULL if missing. */
+   struct level_t **levels;
+   int num_levels;
+   /* Counters for the current level in batch runs, else NULL */
+   struct level_stats_t *stats;
+
+   struct rng_t rng[NUM_RANDOM];
+   uint64_t seed;
+
+   /* Clicks waiting for the simulation to catch up */
+   struct click_t clicks[MAX_CLICKS];
+   int num_clicks;
+   /* Simulation steps since start */
+   Uint32 ticks;
+   /* Steps until time_left is counted down */
+   int second_ticks;
+   int time_left;
+   int spawned_targets;
+   /* Step the level started at, and steps to its first spawn
+    * (-1 until then) */
+   Uint32 level_start;
+   int first_spawn;
+   int total_score;
+   /* Step of the last hit, for the speed bonus */
+   int last_hit;
+
+   int mag_bullets;
+   enum magazine_state mag_state;
+   int mag_delay;
+
+   int bonusangle;
+   int bonusframe;
+   float bonuszoom;
+   bool bonusscore;
+   struct sprite_t bonusspr;
+
+   /* Flags are rotated with their target, so each game has its own */
+   struct sprite_t white_flag;
+   struct sprite_t yellow_flag;
+   struct sprite_t ball;
+   struct flag_t wflag;
+   struct flag_t yflag;
+   struct flag_t bonusball;
+
+   /* Hit tests may lock the surface, so games don't share it */
+   struct sprite_t wave;
+   struct wave_t waves[NUM_WAVES];
+};
+
+/* Batch runs (-B) play games without drawing, on all cores */
+#define BATCH_MAX_THREADS 64
+#define BATCH_MAX_LEVELS 16
+/* The aiming player clicks once every BATCH_AIM_STEPS steps at a
+ * target that has been up BATCH_REACT_STEPS, missing the center of
+ * its circle by up to BATCH_SPREAD pixels. The random player clicks
+ * as often, anywhere on the screen.
+ */
+#define BATCH_AIM_STEPS 20
+#define BATCH_REACT_STEPS 15
+#define BATCH_SPREAD 12
+
+/* Click load (-C): where the clicks go. Seeking clicks land up to
+ * STRESS_SPREAD pixels from a target circle, edge clicks next to
+ * one of up to STRESS_MAX_EDGES pixels where a layer turns opaque.
+ */
+enum click_dist_t {
+   Click_uniform,
+   Click_seek,
+   Click_edge
+};
+#define STRESS_FRAMES 600
+#define STRESS_SPREAD 40
+#define STRESS_MAX_EDGES 65536
+
+/* A thread of a batch run, playing one game after another */
+struct batch_worker_t {
+   struct game_t game;
+   /* Played by game, each thread needs its own copy */
+   struct level_t *levels[BATCH_MAX_LEVELS];
+   struct level_stats_t stats[BATCH_MAX_LEVELS];
+   /* Where the player aims, apart from the game's streams */
+   struct rng_t aim;
+   unsigned long long steps;
+   SDL_Thread *thread;
+};
+
 
 /* ----------------------------------------------
  * Local variables
  * ----------------------------------------------
  */
 static int quit;
-static int pause = 0;
-static int level = 0;
+/* Where level files are, with -d */
+static const char *level_dir = "levels";
+static int paused = 0;
+static int render_fps = FPS;
+static int max_skip = MAX_FRAME_SKIP;
+static bool hud = false;
+
+/* Read events in the input thread instead of the main loop */
+static bool threaded_input = false;
+
+/* Headless benchmark (-b): frames to run, one step each, and
+ * whether to draw them */
+static unsigned int bench_frames = 0;
+static bool bench_draw = true;
+
+/* -G, compare every GOLDEN_EVERY th drawn frame with a golden frame */
+#define GOLDEN_EVERY 60
+/* Default PSNR in dB smoothed frames must reach */
+#define GOLDEN_PSNR 40.0f
+static const char *golden_dir = NULL;
+static bool golden_update = false;
+static float golden_psnr = GOLDEN_PSNR;
+
+/* Batch run: games to play, threads (0 = one per core), clicking
+ * at random instead of aiming and a single level to play (0 = all) */
+static int batch_games = 0;
+static int batch_threads = 0;
+static bool batch_random = false;
+static int batch_only = 0;
+static uint64_t batch_seed;
+/* Next game for a thread to take */
+static volatile int batch_next;
+/* Results of each game, [level * batch_games + game], level 0
+ * for the whole game. Steps to first spawn are -1 if none. */
+static int *batch_score;
+static int *batch_first_spawn;
+
+/* Click load: clicks hit tested each frame and where they go */
+static int stress_clicks = 0;
+static enum click_dist_t stress_dist = Click_uniform;
+static struct rng_t stress_rng;
+/* This frame's clicks and what they hit, without and with hit
+ * masks. ns each frame took, per path. */
+static struct click_t *stress_click;
+static int *stress_hit[2];
+static int *stress_ns[2];
+static unsigned int stress_frames = 0;
+static unsigned long long stress_hits = 0;
+static unsigned long long stress_mismatches = 0;
+/* Layer edges of stress_lv, x and y of each */
+static struct level_t *stress_lv = NULL;
+static int *stress_edge;
+static int stress_edges;
+
+/* Game in the window, the callbacks act on it */
+static struct game_t *played = NULL;
+
 /* Coordinates (x,y) relative "right" sprite */
 static int hole_coords[12] = { 78, 342, 93, 368, 77, 395, 47, 395, 32, 369, 48, 342 };
-static int mag_bullets;
-static enum magazine_state mag_state;
-static int mag_delay;
-static int spawned_targets;
-static int time_left;
-
-static int bonusangle;
-static int bonusframe;
-static float bonuszoom;
-static bool bonusscore;
-
-static struct sprite_t bonusspr;
+
 static struct sprite_t wave;
 static struct sprite_t hole;
 static struct sprite_t numbers;
@@ -151,12 +365,8 @@ static struct sprite_t goldstar;
 static struct sprite_t goldstar2;
 static struct sprite_t goldstars;
 static struct sprite_t skull;
-static struct sprite_t white_flag;
-static struct sprite_t yellow_flag;
-static struct sprite_t ball;
 
 static struct spritestruct_t sprites[] = {
-   { &bonusspr,    "png/skull.png",       },
    { &wave,        "png/wave.png",       },
    { &hole,        "png/bullethole.png", },
    { &numbers,     "png/smallnum.png",   },
@@ -166,45 +376,14 @@ static struct spritestruct_t sprites[] = {
    { &goldstar2,   "png/goldstar2.png",  },
    { &goldstars,   "png/goldstars.png",  },
    { &skull,       "png/skull.png",      },
-   { &white_flag,  "png/flag.png",       },
-   { &yellow_flag, "png/yellowflag.png", },
-   { &ball,        "png/ball.png",       },
    { NULL, NULL }
 };
 
-/* White flag */
-struct flag_t wflag = {
-   &white_flag,
-   1, 55,
-   /* Init rest after loading sprite */
-   0, 0, 0.0f, 0.0f, 0, 0
-};
-
-struct flag_t yflag = {
-   &yellow_flag,
-   1, 55,
-   /* Init rest after loading sprite */
-   0, 0, 0.0f, 0.0f, 0, 0
-};
-
-struct flag_t bonusball = {
-   &ball,
-   15, 28,
-   /* Init rest after loading sprite */
-   0, 0, 0.0f, 0.0f, 0, 0
-};
-
-/* Hardcode params for waves */
-#define WAVE_X 63
-#define WAVE_Y 445
-#define WAVE_AMP_X (68 / 2)
-#define WAVE_AMP_Y (20 / 2)
-#define WAVE_SPACING 25
-#define WAVES 5
-#define NUM_WAVES 2
-static struct wave_t waves[NUM_WAVES];
-
-static int total_score;
+/* WAVES wave segments in one sprite, for the lowest quality */
+static struct sprite_t wave_strip;
+static bool use_wave_strip = false;
+/* Rotozoomed sprites are smoothed, pixels may differ a little between builds */
+static bool smoothed = false;
 
 
 /* ----------------------------------------------
@@ -213,23 +392,82 @@ static int total_score;
  */
 
 
-static bool new_level(void)
+/* Use compiled level if it is up to date, else the text level.
+ * If there are no loose level files, use the level pack.
+ */
+static void level_filename(char *buf, int n)
 {
-   char levelstr[32];
-   bool ret = false;
+   struct stat lvl, txt;
+   char txtstr[LEVEL_PNG_LEN];
+   bool have_txt;
+
+   snprintf(txtstr, LEVEL_PNG_LEN, "%s/level%d.txt", level_dir, n);
+   have_txt = (stat(txtstr, &txt) == 0);
+   snprintf(buf, LEVEL_PNG_LEN, "%s/level%d.lvl", level_dir, n);
+   if (stat(buf, &lvl) == 0 && (!have_txt || lvl.st_mtime >= txt.st_mtime)) {
+      return;
+   }
+   if (have_txt) {
+      snprintf(buf, LEVEL_PNG_LEN, "%s", txtstr);
+   } else {
+      snprintf(buf, LEVEL_PNG_LEN, "%s/" LEVEL_PACK "#%d", level_dir, n);
+   }
+}
+
 
-   level++;
+/* Free the level g plays, levels of other games are kept */
+static void end_level(struct game_t *g)
+{
+   if (g->primary) {
+      free_level();
+   }
+   g->lv = NULL;
+}
+
+
+/* Load the next level, g->lv must be freed with end_level() first */
+static bool new_level(struct game_t *g)
+{
+   char levelstr[LEVEL_PNG_LEN];
+   const struct replay_event_t *e;
+   bool ret = false;
+   int i;
 
-   snprintf(levelstr, 32, "levels/level%d.txt", level);
+   g->level++;
 
-   if (!load_level(levelstr)) {
+   if (!g->primary) {
+      if (g->level <= g->num_levels && g->levels[g->level - 1]) {
+         /* Played before, start over with no targets */
+         g->lv = g->levels[g->level - 1];
+         for (i = 0; i < g->lv->num_targets; i++) {
+            g->lv->targets[i].state = Dead;
+         }
+      }
+   } else {
+      if (replay_playing()) {
+         /* Same level files as the recording */
+         e = replay_peek();
+         if (!e || e->type != Replay_level) {
+            goto out;
+         }
+         snprintf(levelstr, sizeof(levelstr), "%s", e->level);
+         replay_pop();
+      } else {
+         level_filename(levelstr, g->level);
+      }
+      replay_level(g->ticks, levelstr);
+      g->lv = load_level(levelstr);
+   }
+   if (!g->lv) {
       /* Parse error or all levels finished */
-      free_level();
+      end_level(g);
       goto out;
    }
-   spawned_targets = 0;
-   time_left = 40;
-   bonusscore = false;
+   g->spawned_targets = 0;
+   g->level_start = g->ticks;
+   g->first_spawn = -1;
+   g->time_left = 40;
+   g->bonusscore = false;
 
    ret = true;
 
@@ -239,42 +477,63 @@ out:
 }
 
 
-static void count_time(void)
+static void count_time(struct game_t *g)
 {
-   static int frame_counter = FPS;
-
-   if (unlikely(--frame_counter <= 0)) {
-      time_left--;
-      frame_counter = FPS;
+   char levelstr[LEVEL_PNG_LEN];
+
+   if (unlikely(--g->second_ticks <= 0)) {
+      g->time_left--;
+      g->second_ticks = FPS;
+      if (unlikely(g->time_left == PRELOAD_TIME_LEFT && g->primary)) {
+         /* Load next level while this one is played */
+         level_filename(levelstr, g->level + 1);
+         level_preload_start(levelstr);
+      }
    }
 }
 
 
-/* Init new target */
-static void spawn_target(int target_num, bool bonus)
+/* Init a new target of kind, if one of that kind is dead */
+static void spawn_target(struct game_t *g, int kind, bool bonus)
 {
    int num;
-   struct target_t *a = &targets[target_num];
+   struct target_t *a = NULL;
    struct flag_t *f;
 
-   if (unlikely(a->state != Dead)) {
+   for (num = g->lv->first[kind]; num < g->lv->first[kind + 1]; num++) {
+      if (g->lv->targets[num].state == Dead) {
+         a = &g->lv->targets[num];
+         break;
+      }
+   }
+   if (unlikely(!a)) {
       return;
    }
 
    /* Keep count of number of spawned targets.
     * TODO: Diffrentiate between types of targets?
     */
-   spawned_targets++;
-
-   sprite_reset(a->prop.spr);
+   g->spawned_targets++;
+   if (unlikely(g->first_spawn < 0)) {
+      g->first_spawn = g->ticks - g->level_start;
+   }
+   if (g->stats) {
+      g->stats->spawns[kind]++;
+   }
 
    /* Init target state variables */
-   num = (int)(((a->prop.n_x_points - 1) * (rand() / (float)RAND_MAX)) + 0.5);
-   a->sx = bg_x + a->prop.spawn_x_points[num];
-   num = (int)(((a->prop.n_y_points - 1) * (rand() / (float)RAND_MAX)) + 0.5);
-   a->sy = bg_y + a->prop.spawn_y_points[num];
+   num = rng_below(&g->rng[Random_place], a->prop.n_x_points);
+   a->sx = g->lv->bg_x + a->prop.spawn_x_points[num];
+   num = rng_below(&g->rng[Random_place], a->prop.n_y_points);
+   a->sy = g->lv->bg_y + a->prop.spawn_y_points[num];
    a->tx = 0;
    a->ty = 0;
+   a->tfi = 0;
+   a->zoom = 1.0f;
+   a->ptx = 0;
+   a->pty = 0;
+   a->ptfi = 0;
+   a->pzoom = 1.0f;
    a->age = 0;
    a->state = Alive;
 
@@ -286,11 +545,11 @@ static void spawn_target(int target_num, bool bonus)
    } else {
       a->bonus = false;
       /* Flag? */
-      if (unlikely((int)(((10) * (rand() / (float)RAND_MAX)) + 0.5) > 8)) {
+      if (unlikely(rng_float(&g->rng[Random_flag]) >= 0.85f)) {
          a->white = true;
       } else {
          a->white = false;
-         if (unlikely((int)(((10) * (rand() / (float)RAND_MAX)) + 0.5) > 8)) {
+         if (unlikely(rng_float(&g->rng[Random_flag]) >= 0.85f)) {
             a->yellow = true;
          } else {
             a->yellow = false;
@@ -307,11 +566,11 @@ static void spawn_target(int target_num, bool bonus)
       a->flag_ty = a->prop.flag_cy;
       /* White flag */
       if (a->white) {
-         f = &wflag;
+         f = &g->wflag;
       } else if (a->yellow) {
-         f = &yflag;
+         f = &g->yflag;
       } else {
-         f = &bonusball;
+         f = &g->bonusball;
       }
       f->flag_tx = f->flag_cx;
       f->flag_ty = f->flag_cy;
@@ -365,31 +624,43 @@ static void grandfather_pending(struct target_t *a)
 
 
 /**
- * Move targets on screen and spawn new targets
- * now and then.
+ * Advance targets one simulation step and spawn new
+ * targets now and then.
  *
  * Return true if level is finished, else false.
  */
-static bool move_targets(void)
+static bool move_targets(struct game_t *g)
 {
-   bool rot;
-   int i, target;
+   int i, target, rolls;
    struct target_t *a;
 
-   /* New animal once each 2s (don't spawn bonus targets here) */
-   if (unlikely(rand() < (int)(((unsigned long)RAND_MAX + 1) / (FPS * 2)))) {
-      spawn_target(((NUM_TARGETS - 2) * (rand() / (float)RAND_MAX)) + 0.5, false);
+   /* New animal once each 2s (don't spawn bonus targets here), one
+    * more chance for each instance beyond one of each kind */
+   rolls = g->lv->first[NUM_TARGETS - 1] - (NUM_TARGETS - 1);
+   if (rolls < 0) {
+      rolls = 0;
+   }
+   for (i = 0; i <= rolls; i++) {
+      if (unlikely(rng_below(&g->rng[Random_spawn], FPS * 2) == 0)) {
+         spawn_target(g, ((NUM_TARGETS - 2) * rng_float(&g->rng[Random_spawn])) + 0.5, false);
+      }
    }
 /*    spawn_target(NUM_TARGETS - 1, true); */
 
-   for (target = 0; target < NUM_TARGETS; target++) {
+   for (target = 0; target < g->lv->num_targets; target++) {
 
-      a = &targets[target];
+      a = &g->lv->targets[target];
 
       if (likely(a->state == Dead)) {
          continue;
       }
 
+      /* Keep previous step for interpolation */
+      a->ptx = a->tx;
+      a->pty = a->ty;
+      a->ptfi = a->tfi;
+      a->pzoom = a->zoom;
+
       a->age++;
       if (likely(a->state != Hit)) {
          if (unlikely(a->age > a->prop.max_age)) {
@@ -399,11 +670,10 @@ static bool move_targets(void)
          }
       }
 
-      /* Reset translations each frame */
+      /* Reset translations each step */
       a->tx = 0;
       a->ty = 0;
       a->tfi = 0;
-      rot = false;
       /* Horizontal movement */
       if (likely(a->prop.horizontal)) {
          a->tx += horizontal_movement(a->prop.hor_speed, a->age);
@@ -415,30 +685,96 @@ static bool move_targets(void)
       /* Grandfather clock pending */
       if (likely(a->prop.pend)) {
          grandfather_pending(a);
-         rot = true;
       }
 
+      if (unlikely(a->state == Hit)) {
+         if (unlikely(a->age - a->hit_age > 40)) {
+            a->state = Dead;
+            continue;
+         }
+         a->tfi += ((a->age - a->hit_age) * -2 * u8cosf(a->hit_age));
+         for (a->zoom = 1.0f, i = a->hit_age; i < a->age; i++) {
+            a->zoom *= 0.97;
+         }
+      } else {
+         a->zoom = 1.0f;
+      }
+   }
+
+   if (unlikely(g->bonusscore)) {
+      if (unlikely(g->ticks - g->bonusframe > 40)) {
+         g->bonusscore = false;
+      } else {
+         for (g->bonuszoom = 1.0f, i = g->bonusframe; i < (int)g->ticks; i++) {
+            g->bonuszoom *= 0.97;
+         }
+      }
+   }
+
+   /* End level when time is out */
+   return (g->time_left <= 0);
+}
+
+
+/* Reload of magazine (with delays), once each simulation step */
+static void reload_magazine(struct game_t *g)
+{
+   if (unlikely(g->mag_state == Reloading)) {
+      if (likely(g->mag_delay > 0)) {
+         g->mag_delay--;
+      } else {
+         g->mag_delay = 10;
+         g->mag_bullets++;
+         if (unlikely(g->mag_bullets == 6)) {
+            /* Set normal cursor again */
+            if (g->primary) {
+               custom_cursor_alternative(false);
+            }
+            g->mag_state = Ok;
+         }
+      }
+   }
+}
+
+
+/**
+ * Rotate and position targets for drawing, alpha (0..1) of
+ * the way from the previous simulation step to the current.
+ * Clicks are checked against the result, what is on screen.
+ */
+static void pose_targets(struct game_t *g, float alpha)
+{
+   bool rot;
+   int target;
+   float x, y;
+   struct target_t *a;
+
+   for (target = 0; target < g->lv->num_targets; target++) {
+
+      a = &g->lv->targets[target];
+
+      if (likely(a->state == Dead)) {
+         continue;
+      }
+
+      a->rtfi = a->ptfi + (a->tfi - a->ptfi) * alpha;
+      a->rzoom = a->pzoom + (a->zoom - a->pzoom) * alpha;
+      x = a->ptx + (a->tx - a->ptx) * alpha;
+      y = a->pty + (a->ty - a->pty) * alpha;
+      rot = a->prop.pend;
+
       /* Rotate */
       if (likely(rot || a->state == Hit)) {
 
-         if (a->state == Hit) {
-            if (unlikely(a->age - a->hit_age > 40)) {
-               a->state = Dead;
-               continue;
-            }
-            a->tfi += ((a->age - a->hit_age) * -2 * u8cosf(a->hit_age));
-            for (a->zoom = 1.0f, i = a->hit_age; i < a->age; i++) {
-               a->zoom *= 0.97;
-            }
-            sprite_rotozoom(&(a->scorespr), a->scoreangle, 0.9 + (1 - a->zoom) * 0.5);
-         } else {
-            a->zoom = 1.0f;
+         if (a->state == Hit && g->primary && a->scorespr.spr) {
+            /* Only drawn in the window */
+            sprite_rotozoom(&(a->scorespr), a->scoreangle, 0.9 + (1 - a->rzoom) * 0.5);
          }
-         sprite_rotozoom(a->prop.spr, -a->tfi, a->zoom);
+         sprite_rotozoom(a->prop.spr, -a->rtfi, a->rzoom);
 
          /* Adjust for size difference between spr_trans and spr */
-         a->tx -= a->prop.spr->delta_w >> 1;
-         a->ty -= a->prop.spr->delta_h >> 1;
+         x -= a->prop.spr->delta_w >> 1;
+         y -= a->prop.spr->delta_h >> 1;
 
          /* Formula for rotated target:
           * x = r * cos(-fi)
@@ -446,36 +782,30 @@ static bool move_targets(void)
           */
          if (likely(a->prop.targ_cx != 0 || a->prop.targ_cy != 0)) {
             /* Calculate fi for target rotation */
-            a->targ_tx = -1 * a->prop.targ_r * u8cosf(-(a->prop.targ_fi + a->tfi));
-            a->targ_ty = -1 * a->prop.targ_r * u8sinf(-(a->prop.targ_fi + a->tfi));
+            a->targ_tx = -1 * a->prop.targ_r * u8cosf(-(a->prop.targ_fi + a->rtfi));
+            a->targ_ty = -1 * a->prop.targ_r * u8sinf(-(a->prop.targ_fi + a->rtfi));
          }
          if (a->white || a->yellow) {
             if (a->prop.flag_cx != 0 || a->prop.flag_cy != 0) {
-               a->flag_tx = -1 * a->prop.flag_r * u8cosf(-(a->prop.flag_fi + a->tfi));
-               a->flag_ty = -1 * a->prop.flag_r * u8sinf(-(a->prop.flag_fi + a->tfi));
+               a->flag_tx = -1 * a->prop.flag_r * u8cosf(-(a->prop.flag_fi + a->rtfi));
+               a->flag_ty = -1 * a->prop.flag_r * u8sinf(-(a->prop.flag_fi + a->rtfi));
             }
          }
+      } else if (unlikely(a->prop.spr->rz_valid)) {
+         /* Still rotated from its previous life */
+         sprite_reset(a->prop.spr);
       }
 
-      /* Calculate final position */
-      a->x = a->sx + a->tx;
-      a->y = a->sy + a->ty;
-      sprite_set_pos(*(a->prop.spr), a->x, a->y);
+      /* Calculate final position, and size in case a clipped blit
+       * shrunk the rect */
+      a->x = a->sx + x;
+      a->y = a->sy + y;
+      sprite_place(*(a->prop.spr), a->x, a->y);
    }
 
-   if (unlikely(bonusscore)) {
-      if (unlikely(frames - bonusframe > 40)) {
-         bonusscore = false;
-      } else {
-         for (bonuszoom = 1.0f, i = bonusframe; i < (int)frames; i++) {
-            bonuszoom *= 0.97;
-         }
-         sprite_rotozoom(&bonusspr, bonusangle, 0.9 + (1 - bonuszoom) * 0.5);
-      }
+   if (unlikely(g->bonusscore) && g->primary) {
+      sprite_rotozoom(&g->bonusspr, g->bonusangle, 0.9 + (1 - g->bonuszoom) * 0.5);
    }
-
-   /* End level when time is out */
-   return (time_left <= 0);
 }
 
 
@@ -483,6 +813,12 @@ static bool move_targets(void)
 static inline void draw_wave(struct wave_t *w)
 {
    int i;
+
+   if (unlikely(use_wave_strip)) {
+      sprite_set_pos(wave_strip, w->x, w->y);
+      sprite_blit(wave_strip);
+      return;
+   }
    for (i = 0; i < WAVES; i++) {
       sprite_set_pos(wave, w->x + i * w->width, w->y);
       sprite_blit(wave);
@@ -490,13 +826,13 @@ static inline void draw_wave(struct wave_t *w)
 }
 
 
-static inline bool hit_wave(int x, int y, struct wave_t *w)
+static inline bool hit_wave(struct game_t *g, int x, int y, struct wave_t *w)
 {
    int i;
 
    for (i = 0; i < WAVES; i++) {
-      sprite_set_pos(wave, w->x + i * w->width, w->y);
-      if (unlikely(wave.sprite_collide(&wave, x, y))) {
+      sprite_set_pos(g->wave, w->x + i * w->width, w->y);
+      if (unlikely(g->wave.sprite_collide(&g->wave, x, y))) {
          return true;
       }
    }
@@ -505,24 +841,25 @@ static inline bool hit_wave(int x, int y, struct wave_t *w)
 
 
 /* Check if (x,y) hit layers in front of a */
-static bool hit_layers(struct target_t *a, int x, int y)
+static bool hit_layers(struct game_t *g, struct target_t *a, int x, int y)
 {
    int i = 0;
    struct sprite_t *sprp;
+   TRACE_SCOPE("hit_layers");
 
    /* Loop through layers list */
    while (a->prop.layers[i] >= 0) {
-      sprp = layers[a->prop.layers[i]].spr;
+      sprp = g->lv->layers[a->prop.layers[i]].spr;
       if (unlikely(sprp->sprite_collide(sprp, x, y))) {
          return true;
       }
       i++;
    }
    /* Check waves */
-   if (unlikely(a->prop.wave1 && hit_wave(x, y, &waves[0]))) {
+   if (unlikely(a->prop.wave1 && hit_wave(g, x, y, &g->waves[0]))) {
       return true;
    }
-   if (unlikely(a->prop.wave2 && hit_wave(x, y, &waves[1]))) {
+   if (unlikely(a->prop.wave2 && hit_wave(g, x, y, &g->waves[1]))) {
       return true;
    }
    return false;
@@ -553,6 +890,85 @@ static void draw_number(int x, int y, unsigned int num)
 }
 
 
+/* Performance HUD, toggled with h. Rows, top to bottom:
+ *  - last frame time and worst of the last PROFILE_FRAMES (us)
+ *  - frame time graph, red bars are over the frame time
+ *  - handle_events, move_targets, draw_layers, video_flip, sleep (us)
+ *  - blits, pixels blitted, surfaces created, living targets
+ * A colour marker in front of each number tells which it is.
+ */
+#define HUD_X 8
+#define HUD_Y 8
+#define HUD_COL 64
+#define HUD_ROW 12
+#define HUD_GRAPH_H 32
+
+static void hud_number(int col, int y, unsigned int num, Uint8 r, Uint8 g, Uint8 b)
+{
+   int x = HUD_X + 4 + col * HUD_COL;
+
+   video_fill_rect(x, y, 3, sprite_height(numbers), r, g, b);
+   draw_number(x + (HUD_COL >> 1), y, num);
+}
+
+
+static void draw_hud(struct game_t *g)
+{
+   static const Uint8 phase_rgb[NUM_PHASES][3] = {
+      { 255, 255, 0 }, { 0, 255, 255 }, { 255, 0, 255 }, { 255, 128, 0 }, { 128, 128, 255 }
+   };
+   long long budget = 1000000000LL / render_fps;
+   long long ft, worst = 0;
+   int i, h, y;
+   int alive = 0;
+
+   for (i = 0; i < PROFILE_FRAMES; i++) {
+      if (profile_frame_time(i) > worst) {
+         worst = profile_frame_time(i);
+      }
+   }
+   for (i = 0; i < g->lv->num_targets; i++) {
+      if (g->lv->targets[i].state != Dead) {
+         alive++;
+      }
+   }
+
+   video_fill_rect(HUD_X, HUD_Y, 8 + NUM_PHASES * HUD_COL,
+                   8 + 3 * HUD_ROW + HUD_GRAPH_H + 4, 16, 16, 16);
+
+   y = HUD_Y + 4;
+   hud_number(0, y, profile_frame_time(0) / 1000, 255, 255, 255);
+   hud_number(1, y, worst / 1000, 255, 0, 0);
+
+   /* Graph, newest frame to the right, budget is half height */
+   y += HUD_ROW;
+   video_fill_rect(HUD_X + 4, y + (HUD_GRAPH_H >> 1), PROFILE_FRAMES * 2, 1, 96, 96, 96);
+   for (i = 0; i < PROFILE_FRAMES; i++) {
+      ft = profile_frame_time(i);
+      h = ft * (HUD_GRAPH_H >> 1) / budget;
+      if (h > HUD_GRAPH_H) {
+         h = HUD_GRAPH_H;
+      }
+      if (ft > budget + budget / 20) {
+         video_fill_rect(HUD_X + 4 + (PROFILE_FRAMES - 1 - i) * 2, y + HUD_GRAPH_H - h, 2, h, 255, 0, 0);
+      } else {
+         video_fill_rect(HUD_X + 4 + (PROFILE_FRAMES - 1 - i) * 2, y + HUD_GRAPH_H - h, 2, h, 0, 192, 0);
+      }
+   }
+
+   y += HUD_GRAPH_H + 4;
+   for (i = 0; i < NUM_PHASES; i++) {
+      hud_number(i, y, profile_last(i) / 1000, phase_rgb[i][0], phase_rgb[i][1], phase_rgb[i][2]);
+   }
+
+   y += HUD_ROW;
+   hud_number(0, y, profile_counter(Count_blits), 0, 255, 0);
+   hud_number(1, y, profile_counter(Count_pixels_written), 0, 128, 255);
+   hud_number(2, y, profile_counter(Count_surfaces_created), 255, 64, 64);
+   hud_number(3, y, alive, 255, 255, 255);
+}
+
+
 static void rotate_flag(struct flag_t *f, float tfi, float zoom)
 {
    sprite_rotozoom(f->sprite, -tfi, zoom);
@@ -564,28 +980,44 @@ static void rotate_flag(struct flag_t *f, float tfi, float zoom)
 }
 
 
-static void draw_target(struct target_t *a)
+/* Rotate and place the flag (or bonus ball) of a posed target.
+ * Flag sprites are shared, so this is done right before use.
+ * Return the flag, NULL if a has none.
+ */
+static struct flag_t *pose_flag(struct game_t *g, struct target_t *a)
+{
+   struct flag_t *f;
+
+   if (!(a->white || a->yellow || a->bonus)) {
+      return NULL;
+   }
+   if (a->white) {
+      f = &g->wflag;
+   } else if (a->yellow) {
+      f = &g->yflag;
+   } else {
+      f = &g->bonusball;
+   }
+   if (a->bonus) {
+      rotate_flag(f, -a->rtfi, a->rzoom);
+   } else {
+      rotate_flag(f, a->rtfi + a->prop.flag_extra_fi, a->rzoom);
+   }
+   sprite_set_pos(*(f->sprite),
+                  a->x + ((target_w(a) >> 1) + a->flag_tx - f->flag_tx) * a->rzoom,
+                  a->y + ((target_h(a) >> 1) + a->flag_ty - f->flag_ty) * a->rzoom);
+   return f;
+}
+
+
+static void draw_target(struct game_t *g, struct target_t *a)
 {
    struct flag_t *f;
 
    if (a->state != Dead) {
       /* Calculate flagpos */
-      if (a->white || a->yellow || a->bonus) {
-         if (a->white) {
-            f = &wflag;
-         } else if (a->yellow) {
-            f = &yflag;
-         } else {
-            f = &bonusball;
-         }
-         if (a->bonus) {
-            rotate_flag(f, -a->tfi, a->zoom);
-         } else {
-            rotate_flag(f, a->tfi + a->prop.flag_extra_fi, a->zoom);
-         }
-         sprite_set_pos(*(f->sprite),
-                        a->x + ((target_w(a) >> 1) + a->flag_tx - f->flag_tx) * a->zoom,
-                        a->y + ((target_h(a) >> 1) + a->flag_ty - f->flag_ty) * a->zoom);
+      f = pose_flag(g, a);
+      if (f) {
          sprite_blit(*(f->sprite));
       }
 
@@ -604,102 +1036,127 @@ static void draw_target(struct target_t *a)
 }
 
 
-static void draw_layers(void)
+/* Trade looks for speed according to video_quality() */
+static void set_quality(int q)
+{
+   static const float angle_step[VIDEO_QUALITY_MAX + 1] = { 4, 2, 0, 0 };
+
+   sprite_rotozoom_quality(q == VIDEO_QUALITY_MAX, angle_step[q]);
+   use_wave_strip = (q == 0 && wave_strip.spr);
+   smoothed = (q == VIDEO_QUALITY_MAX);
+   DBG("Quality %d", q);
+}
+
+
+/* Place waves alpha (0..1) of the way from the previous step */
+static void pose_waves(struct game_t *g, float alpha)
+{
+   float period = g->ticks + alpha;
+
+   g->waves[0].x = g->lv->bg_x + WAVE_X + WAVE_AMP_X + WAVE_AMP_X * u8sinf(-period * 0.69);
+   g->waves[0].y = g->lv->bg_y + WAVE_Y + WAVE_AMP_Y * u8sinf(period * 0.41);
+   g->waves[1].x = g->lv->bg_x + WAVE_X + WAVE_AMP_X + WAVE_AMP_X * u8sinf(period * 0.59);
+   g->waves[1].y = g->lv->bg_y + WAVE_Y + WAVE_AMP_Y * u8sinf(period * 0.63) + WAVE_SPACING;
+}
+
+
+/* Draw the targets of kind k */
+static void draw_kind(struct game_t *g, int k)
+{
+   int i;
+
+   for (i = g->lv->first[k]; i < g->lv->first[k + 1]; i++) {
+      draw_target(g, &g->lv->targets[i]);
+   }
+}
+
+
+/* Draw alpha (0..1) of the way from the previous simulation step */
+static void draw_layers(struct game_t *g, float alpha)
 {
-   static int period = 0;
    int i;
 
-   sprite_blit(*(layers[L_bg0].spr));
+   pose_targets(g, alpha);
+   pose_waves(g, alpha);
+
+   sprite_blit(*(g->lv->layers[L_bg0].spr));
 
    /* Slot 1, penguin */
 
-   draw_target(&targets[5]);
+   draw_kind(g, 5);
 
-   sprite_blit(*(layers[L_right_deco].spr));
-   sprite_blit(*(layers[L_bg1].spr));
+   sprite_blit(*(g->lv->layers[L_right_deco].spr));
+   sprite_blit(*(g->lv->layers[L_bg1].spr));
 
    /* Slot 2, seal (bonus), hen */
 
-   draw_target(&targets[6]);
-   draw_target(&targets[4]);
+   draw_kind(g, 6);
+   draw_kind(g, 4);
 
-   sprite_blit(*(layers[L_left_deco].spr));
-   sprite_blit(*(layers[L_bg2].spr));
+   sprite_blit(*(g->lv->layers[L_left_deco].spr));
+   sprite_blit(*(g->lv->layers[L_bg2].spr));
 
    /* Slot 3, dolphin, pelican */
 
-   draw_target(&targets[3]);
-   draw_target(&targets[2]);
+   draw_kind(g, 3);
+   draw_kind(g, 2);
 
-   waves[0].x = bg_x + WAVE_X + WAVE_AMP_X + WAVE_AMP_X * u8sin(-period * 0.69);
-   waves[0].y = bg_y + WAVE_Y + WAVE_AMP_Y * u8sin(period * 0.41);
-   draw_wave(&waves[0]);
+   draw_wave(&g->waves[0]);
 
    /* Slot 4, fish */
 
-   draw_target(&targets[1]);
+   draw_kind(g, 1);
 
-   waves[1].x = bg_x + WAVE_X + WAVE_AMP_X + WAVE_AMP_X * u8sin(period * 0.59);
-   waves[1].y = bg_y + WAVE_Y + WAVE_AMP_Y * u8sin(period * 0.63) + WAVE_SPACING;
-   draw_wave(&waves[1]);
+   draw_wave(&g->waves[1]);
 
 
    /* Slot 5. Bird */
 
-   draw_target(&targets[0]);
+   draw_kind(g, 0);
 
-   sprite_blit(*(layers[L_top].spr));
-   sprite_blit(*(layers[L_left].spr));
-   sprite_blit(*(layers[L_right].spr));
-   sprite_blit(*(layers[L_bottom].spr));
+   sprite_blit(*(g->lv->layers[L_top].spr));
+   sprite_blit(*(g->lv->layers[L_left].spr));
+   sprite_blit(*(g->lv->layers[L_right].spr));
+   sprite_blit(*(g->lv->layers[L_bottom].spr));
 
    /* Draw hitscores */
-   for (i = 0; i < NUM_TARGETS; i++) {
-      if (unlikely(targets[i].state == Hit)) {
-         sprite_blit(targets[i].scorespr);
+   for (i = 0; i < g->lv->num_targets; i++) {
+      if (unlikely(g->lv->targets[i].state == Hit) && g->lv->targets[i].scorespr.spr) {
+         sprite_blit(g->lv->targets[i].scorespr);
       }
    }
 
    /* Hitscore for bonus ball */
-   if (unlikely(bonusscore)) {
-      sprite_blit(bonusspr);
+   if (unlikely(g->bonusscore)) {
+      sprite_blit(g->bonusspr);
    }
 
-   /* Reload of magazine (with delays) */
-   if (unlikely(mag_state == Reloading)) {
-      if (likely(mag_delay > 0)) {
-         mag_delay--;
-      } else {
-         mag_delay = 10;
-         mag_bullets++;
-         if (unlikely(mag_bullets == 6)) {
-            /* Set normal cursor again */
-            custom_cursor_alternative(false);
-            mag_state = Ok;
-         }
-      }
-   }
    /* Draw bullet holes */
-   for (i = 0; i < 6 - mag_bullets; i++) {
+   for (i = 0; i < 6 - g->mag_bullets; i++) {
       sprite_set_pos(hole,
-                     layers[L_right].spr->rect.x + hole_coords[i << 1],
-                     layers[L_right].spr->rect.y + hole_coords[(i << 1) + 1]);
+                     g->lv->layers[L_right].spr->rect.x + hole_coords[i << 1],
+                     g->lv->layers[L_right].spr->rect.y + hole_coords[(i << 1) + 1]);
       sprite_blit(hole);
    }
 
    /* Draw score */
-   draw_number(92, 244, total_score);
+   draw_number(92, 244, g->total_score);
 
    /* Draw time left */
-   draw_number(92, 299, time_left);
+   draw_number(92, 299, g->time_left);
 
-   period++;
+   if (unlikely(hud)) {
+      draw_hud(g);
+   }
 }
 
 
-/* Init flag properties */
-static void init_flag(struct flag_t *f)
+/* Init flag properties, (x, y) is where it attaches to the target */
+static void init_flag(struct flag_t *f, struct sprite_t *sprite, int x, int y)
 {
+   f->sprite = sprite;
+   f->flag_x = x;
+   f->flag_y = y;
    /* cx,cy */
    f->flag_cx = f->flag_x - (sprite_width(*(f->sprite)) >> 1);
    f->flag_cy = f->flag_y - (sprite_height(*(f->sprite)) >> 1);
@@ -710,6 +1167,8 @@ static void init_flag(struct flag_t *f)
    if (f->flag_cy < 0) {
       f->flag_fi = 256.0 - f->flag_fi;
    }
+   f->flag_tx = 0;
+   f->flag_ty = 0;
 }
 
 
@@ -720,11 +1179,17 @@ static void game_init(int width, int height)
 
    /* video_init exits on failure */
    video_init(width, height);
+   if (threaded_input) {
+      input_thread_start();
+   }
    /* Set framerate (will be correct if computer is fast enough) */
-   video_set_preferred_framerate(FPS);
+   video_set_preferred_framerate(render_fps);
    custom_cursor_init();
    quit = false;
 
+   /* No-op unless built with EMBED_ASSETS */
+   sprite_inflate_embedded();
+
    i = 0;
    while (sprites[i].spr) {
       if(!sprite_load_from_png(sprites[i].spr, sprites[i].png, true)) {
@@ -734,26 +1199,12 @@ static void game_init(int width, int height)
       i++;
    }
 
-   /* Init flags */
-   init_flag(&wflag);
-   init_flag(&yflag);
-   init_flag(&bonusball);
-
-   /* Init num bullets in magazine */
-   mag_bullets = 6;
-   mag_state = Ok;
-
-   /* Init waves */
-   for (i = 0; i < NUM_WAVES; i++) {
-      waves[i].width = sprite_width(wave);
-      waves[i].height = sprite_height(wave);
+   if (!sprite_tile(&wave_strip, &wave, WAVES)) {
+      WARN("No wave strip, waves drawn in segments at all qualities");
    }
+   set_quality(video_quality());
 
-   /* Start with score 0 ;-) */
-   total_score = 0;
-
-   /* Seed random number generator */
-   srand(time(NULL));
+   level_preload_limit(PRELOAD_MAX_BYTES);
 }
 
 
@@ -761,49 +1212,153 @@ static void game_cleanup(void)
 {
    int i = 0;
 
+   input_thread_stop();
+   level_preload_cancel();
+   level_pack_close();
+
    while (sprites[i].spr) {
       sprite_free(sprites[i].spr);
       i++;
    }
+   if (wave_strip.spr) {
+      sprite_free(&wave_strip);
+   }
 
    custom_cursor_free();
 }
 
 
-static void set_bonusspr(int posx, int posy, unsigned int score)
+/* Start g over from seed, keeping its sprites and levels */
+static void game_reset(struct game_t *g, uint64_t seed)
+{
+   int i;
+
+   g->lv = NULL;
+   g->level = 0;
+   g->num_clicks = 0;
+   g->ticks = 0;
+   g->time_left = 0;
+   g->spawned_targets = 0;
+   g->last_hit = 0;
+   g->bonusscore = false;
+   g->bonusframe = 0;
+
+   /* Init num bullets in magazine */
+   g->mag_bullets = 6;
+   g->mag_state = Ok;
+   g->mag_delay = 0;
+
+   g->second_ticks = FPS;
+
+   /* Start with score 0 ;-) */
+   g->total_score = 0;
+
+   /* Seed random number streams, same seed plays the same game */
+   g->seed = seed;
+   for (i = 0; i < NUM_RANDOM; i++) {
+      rng_seed(&g->rng[i], seed, i);
+   }
+}
+
+
+/* Set up a new game before its first level, after game_init() */
+static bool game_start(struct game_t *g, uint64_t seed, bool primary)
+{
+   struct spritestruct_t own[] = {
+      { &g->bonusspr,    "png/skull.png",      },
+      { &g->white_flag,  "png/flag.png",       },
+      { &g->yellow_flag, "png/yellowflag.png", },
+      { &g->ball,        "png/ball.png",       },
+      { &g->wave,        "png/wave.png",       },
+      { NULL, NULL }
+   };
+   int i;
+
+   memset(g, 0, sizeof(*g));
+   g->primary = primary;
+
+   for (i = 0; own[i].spr; i++) {
+      if (!sprite_load_from_png(own[i].spr, own[i].png, true)) {
+         WARN("sprite_load_from_png failed for %s", own[i].png);
+         return false;
+      }
+   }
+
+   /* Init flags */
+   init_flag(&g->wflag, &g->white_flag, 1, 55);
+   init_flag(&g->yflag, &g->yellow_flag, 1, 55);
+   init_flag(&g->bonusball, &g->ball, 15, 28);
+
+   /* Init waves */
+   for (i = 0; i < NUM_WAVES; i++) {
+      g->waves[i].width = sprite_width(g->wave);
+      g->waves[i].height = sprite_height(g->wave);
+   }
+
+   game_reset(g, seed);
+
+   return true;
+}
+
+
+/* Free what game_start() allocated and the level g plays */
+static void game_stop(struct game_t *g)
+{
+   struct sprite_t *own[] = {
+      &g->bonusspr, &g->white_flag, &g->yellow_flag, &g->ball, &g->wave
+   };
+   unsigned int i;
+
+   if (g->lv) {
+      end_level(g);
+   }
+   for (i = 0; i < sizeof(own) / sizeof(own[0]); i++) {
+      if (own[i]->spr) {
+         sprite_free(own[i]);
+      }
+   }
+}
+
+
+static void set_bonusspr(struct game_t *g, int posx, int posy, unsigned int score)
 {
    int numw;
    int y;
    int dx, i, digit;
 
    /* Erase scorespr and reset width and height */
-   sprite_reset_dimensions(bonusspr);
-   sprite_erase(&bonusspr);
-   sprite_blit_dest(goldstars, bonusspr);
+   sprite_reset_dimensions(g->bonusspr);
+   sprite_erase(&g->bonusspr);
+   sprite_blit_dest(goldstars, g->bonusspr);
    /* Calc coordinates */
-   y = (sprite_height(bonusspr) - sprite_height(bignum)) >> 1;
+   y = (sprite_height(g->bonusspr) - sprite_height(bignum)) >> 1;
    numw = sprite_width(bignum) / 10;
-   dx = (sprite_width(bonusspr) - 3 * numw) >> 2;
+   dx = (sprite_width(g->bonusspr) - 3 * numw) >> 2;
    for (i = 2; i >= 0; i--) {
       digit = score % 10;
       score /= 10;
-      sprite_blit_part_dest(&bignum, &bonusspr, digit * numw, 0,
-                            i * sprite_width(bonusspr) / 3 + dx, y,
+      sprite_blit_part_dest(&bignum, &g->bonusspr, digit * numw, 0,
+                            i * sprite_width(g->bonusspr) / 3 + dx, y,
                             numw, sprite_height(bignum));
    }
-   sprite_set_pos(bonusspr, posx, posy);
-   bonusangle = (int)((20 * (rand() / (float)RAND_MAX)) + 0.5) - 10;
-   bonusscore = true;
+   sprite_set_pos(g->bonusspr, posx, posy);
+   g->bonusangle = rng_below(&g->rng[Random_score], 21) - 10;
+   g->bonusscore = true;
 }
 
 
-static void set_scorespr(struct target_t *a, unsigned int score)
+static void set_scorespr(struct game_t *g, struct target_t *a, unsigned int score)
 {
    int numw;
    int y;
    int dx, i, digit;
    struct sprite_t *nums = &bignum;
 
+   /* First hit of this target */
+   if (!a->scorespr.spr && !sprite_tile(&(a->scorespr), &g->lv->scorespr, 1)) {
+      return;
+   }
+
    /* Erase scorespr and reset width and height */
    sprite_reset_dimensions(a->scorespr);
    sprite_erase(&(a->scorespr));
@@ -829,7 +1384,7 @@ static void set_scorespr(struct target_t *a, unsigned int score)
                             numw, sprite_height(bignum));
    }
    sprite_set_pos(a->scorespr, a->x, a->y);
-   a->scoreangle = (int)((20 * (rand() / (float)RAND_MAX)) + 0.5) - 10;
+   a->scoreangle = rng_below(&g->rng[Random_score], 21) - 10;
 }
 
 
@@ -848,199 +1403,1153 @@ void escape_pressed(void)
 /* Callback for pause key (p), called from handle_events() */
 void pause_pressed(void)
 {
-   pause = 1 - pause;
+   replay_key(played->ticks, 'p');
+   paused = 1 - paused;
 }
 
 
-/* Callback for mouseclick, called from handle_events() */
-void mouse_clicked(int x, int y)
+/* Callback for HUD key (h), called from handle_events() */
+void hud_pressed(void)
 {
-   int bullx, bully;
-   int r2, c1, c2;
-   int i;
+   replay_key(played->ticks, 'h');
+   hud = !hud;
+}
+
+
+/* Callback for timing key (t), called from handle_events() */
+void timing_pressed(void)
+{
+   replay_key(played->ticks, 't');
+   profile_print();
+}
+
+
+/* Callback for mouseclick, called from handle_events(). Clicks are
+ * queued and resolved by resolve_clicks() when the simulation has
+ * reached the time t (ns) they were made.
+ */
+void mouse_clicked(int x, int y, long long t)
+{
+   struct click_t *c;
+
+   if (replay_playing()) {
+      /* Clicks come from the replay */
+      return;
+   }
+   if (unlikely(played->num_clicks == MAX_CLICKS)) {
+      WARN("Click queue full, click dropped");
+      return;
+   }
+   c = &played->clicks[played->num_clicks++];
+   c->x = x;
+   c->y = y;
+   c->t = t;
+}
+
+
+/**
+ * Where a shot at (x, y) hits a, with a and what is in front of
+ * it posed. *ball is set if it hits the bonus ball of a. Changes
+ * nothing, so it can be asked any number of times.
+ */
+static enum ring_t hit_target(struct game_t *g, struct target_t *a, int x, int y, bool *ball)
+{
+   int bullx, bully;
+   int r2, c1, c2;
+
+   *ball = false;
+   if (unlikely(a->bonus)) {
+      pose_flag(g, a);
+      /* Check collission against ball */
+      if ((g->bonusball.sprite)->sprite_collide(g->bonusball.sprite, x, y)) {
+         if (unlikely(hit_layers(g, a, x, y))) {
+            DBG("Hit layer in front of bonusball");
+         } else {
+            *ball = true;
+         }
+      }
+   }
+
+   bullx = a->x + (target_w(a) >> 1) + a->targ_tx;
+   bully = a->y + (target_h(a) >> 1) + a->targ_ty;
+   /* Pythagoras says: c1 * c1 + c2 * c2 = r * r
+    *   x,y
+    *    .
+    *    |\ r
+    * c2 | \
+    *    |__. bullx, bully
+    *     c1
+    */
+   c1 = x - bullx;
+   c2 = y - bully;
+   r2 = (c1 * c1 + c2 * c2);
+   /* Check if target circle hit, prop->targ_r_* values are already squared. */
+   if (r2 <= a->prop.targ_r_outer) {
+      if (unlikely(hit_layers(g, a, x, y))) {
+         DBG("Hit layer in front of target circle");
+         return Ring_miss;
+      }
+      if (r2 <= a->prop.targ_r_middle) {
+         if (r2 <= a->prop.targ_r_inner) {
+            DBG("Inner (%d, %.2f)", r2, SQRTFAST(r2));
+            return Ring_inner;
+         }
+         DBG("Middle (%d, %.2f)", r2, SQRTFAST(r2));
+         return Ring_middle;
+      }
+      DBG("Outer (%d, %.2f)", r2, SQRTFAST(r2));
+      return Ring_outer;
+   } else if (a->prop.spr->sprite_collide(a->prop.spr, x, y)) {
+      /* Animal hit outside target circle */
+      if (unlikely(hit_layers(g, a, x, y))) {
+         DBG("Hit layer in front of animal, outside target circle");
+         return Ring_miss;
+      }
+      DBG("Outside target circle (%.2f)", SQRTFAST(r2));
+      return Ring_body;
+   }
+
+   return Ring_miss;
+}
+
+
+/* Fire at (x, y) with targets posed where they were at the click */
+static void shoot(struct game_t *g, int x, int y)
+{
+   int i;
    int score;
    struct target_t *a;
    int speed_bonus;
-   static int last_hit = 0;
    bool bonus = false;
+   bool ball;
+   enum ring_t ring = Ring_miss;
 
    /* Check magazine */
-   if (unlikely(mag_bullets == 0)) {
-      mag_state = Reloading;
-      mag_delay = 0;
+   if (unlikely(g->mag_bullets == 0)) {
+      g->mag_state = Reloading;
+      g->mag_delay = 0;
    }
-   if (unlikely(mag_state == Reloading)) {
+   if (unlikely(g->mag_state == Reloading)) {
       return;
    }
 
    /* Mag state is Ok, fire */
-   mag_bullets--;
-   if (unlikely(mag_bullets == 0)) {
+   g->mag_bullets--;
+   if (unlikely(g->mag_bullets == 0)) {
       /* Set alternative cursor marking empty mag */
-      custom_cursor_alternative(true);
+      if (g->primary) {
+         custom_cursor_alternative(true);
+      }
    }
 
    /* Collission detection */
-   for (i = 0; i < NUM_TARGETS; i++) {
-      a = &targets[i];
+   for (i = 0; i < g->lv->num_targets; i++) {
+      a = &g->lv->targets[i];
       score = 0;
       if (unlikely(a->state > Dead && a->state < Hit)) {
 
          /* Calculate speed bonus according to formula in doc/game_rules.jsp */
-         speed_bonus = 10 - 6 * ((frames - last_hit) / (float)FPS);
+         speed_bonus = 10 - 6 * ((g->ticks - g->last_hit) / (float)FPS);
          if (speed_bonus < 0) {
             speed_bonus = 0;
          }
 
-         if (unlikely(a->bonus)) {
-            /* Check collission against ball */
-            if ((bonusball.sprite)->sprite_collide(bonusball.sprite, x, y)) {
-               if (unlikely(hit_layers(a, x, y))) {
-                  DBG("Hit layer in front of bonusball");
-               } else {
-                  /* Hit ball */
-                  score += 500;
-                  a->bonus = false;
-                  bonusframe = frames;
-                  set_bonusspr(bonusball.sprite->rect.x - sprite_width(*(bonusball.sprite)),
-                               bonusball.sprite->rect.y - sprite_height(*(bonusball.sprite)), score);
-               }
+         ring = hit_target(g, a, x, y, &ball);
+         if (unlikely(ball)) {
+            /* Hit ball */
+            score += 500;
+            a->bonus = false;
+            g->bonusframe = g->ticks;
+            if (g->stats) {
+               g->stats->bonus_hits++;
+            }
+            if (g->primary) {
+               set_bonusspr(g, g->bonusball.sprite->rect.x - sprite_width(*(g->bonusball.sprite)),
+                            g->bonusball.sprite->rect.y - sprite_height(*(g->bonusball.sprite)), score);
             }
          }
 
-         bullx = a->x + (target_w(a) >> 1) + a->targ_tx;
-         bully = a->y + (target_h(a) >> 1) + a->targ_ty;
-         /* Pythagoras says: c1 * c1 + c2 * c2 = r * r
-          *   x,y
-          *    .
-          *    |\ r
-          * c2 | \
-          *    |__. bullx, bully
-          *     c1
-          */
-         c1 = x - bullx;
-         c2 = y - bully;
-         r2 = (c1 * c1 + c2 * c2);
          a->goldstar = None;
-         /* Check if target circle hit, prop->targ_r_* values are already squared. */
-         if (r2 <= a->prop.targ_r_outer) {
-            if (unlikely(hit_layers(a, x, y))) {
-               DBG("Hit layer in front of target circle");
-            } else {
-               /* Inside target circle, check if yellow flag */
-               if (unlikely(a->yellow)) {
-                  bonus = true;
-               }
-               if (r2 <= a->prop.targ_r_middle) {
-                  if (r2 <= a->prop.targ_r_inner) {
-                     score += a->prop.base_points * 2.0 + speed_bonus;
-                     a->goldstar = Stars;
-                     DBG("Inner (%d, %.2f), score = %d", r2, SQRTFAST(r2), score);
-                  } else {
-                     score += a->prop.base_points * 1.5 + speed_bonus;
-                     a->goldstar = Star2;
-                     DBG("Middle (%d, %.2f), score = %d", r2, SQRTFAST(r2), score);
-                  }
-               } else {
-                  score += a->prop.base_points * 1.2 + speed_bonus;
-                  a->goldstar = Star;
-                  DBG("Outer (%d, %.2f), score = %d", r2, SQRTFAST(r2), score);
-               }
-               a->state = Hit;
-               a->hit_age = a->age;
-               last_hit = frames;
-               if (unlikely(a->white)) {
-                  a->goldstar = Skull;
-               }
-               set_scorespr(a, score);
+         switch (ring) {
+         case Ring_inner:
+            score += a->prop.base_points * 2.0 + speed_bonus;
+            a->goldstar = Stars;
+            break;
+         case Ring_middle:
+            score += a->prop.base_points * 1.5 + speed_bonus;
+            a->goldstar = Star2;
+            break;
+         case Ring_outer:
+            score += a->prop.base_points * 1.2 + speed_bonus;
+            a->goldstar = Star;
+            break;
+         case Ring_body:
+            score += a->prop.base_points + speed_bonus;
+            break;
+         default:
+            break;
+         }
+         if (ring != Ring_miss) {
+            /* Inside target circle, check if yellow flag */
+            if (unlikely(a->yellow) && ring != Ring_body) {
+               bonus = true;
             }
-         } else if (a->prop.spr->sprite_collide(a->prop.spr, x, y)) {
-            /* Animal hit outside target circle */
-            if (unlikely(hit_layers(a, x, y))) {
-               DBG("Hit layer in front of animal, outside target circle");
-            } else {
-               score += a->prop.base_points + speed_bonus;
-               DBG("Outside target circle (%.2f), score = %d", SQRTFAST(r2), score);
-               a->state = Hit;
-               a->hit_age = a->age;
-               last_hit = frames;
-               if (unlikely(a->white)) {
-                  a->goldstar = Skull;
-               }
-               set_scorespr(a, score);
+            a->state = Hit;
+            a->hit_age = a->age;
+            g->last_hit = g->ticks;
+            if (unlikely(a->white)) {
+               a->goldstar = Skull;
             }
-         } else {
-            /* DBG("Miss"); */
+            if (g->primary) {
+               set_scorespr(g, a, score);
+            }
+            DBG("Score = %d", score);
          }
          /* Add score (if any) to total_score */
          if (score > 0) {
+            if (g->primary) {
+               replay_hit(g->ticks, i, score);
+            }
             if (unlikely(a->white)) {
                /* Hit white flag target */
-               total_score -= score;
-               if (total_score < 0) {
-                  total_score = 0;
+               g->total_score -= score;
+               if (g->total_score < 0) {
+                  g->total_score = 0;
                }
             } else {
-               total_score += score;
+               g->total_score += score;
             }
             /* Break loop if target is hit */
             break;
          }
       }
    }
+   if (g->stats) {
+      g->stats->shots[score > 0 ? ring : Ring_miss]++;
+   }
    /* Only one bonus animal possible per click */
    if (unlikely(bonus)) {
       /* Spawn bonus target */
-      spawn_target(NUM_TARGETS - 1, true);
+      spawn_target(g, NUM_TARGETS - 1, true);
    }
 }
 
 
-int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+/* Shoot at (x, y) with everything posed offset ns into the step */
+static void resolve_click(struct game_t *g, int offset, int x, int y)
 {
+   float alpha = offset / (float)TICK_NS;
+
+   pose_targets(g, alpha);
+   pose_waves(g, alpha);
+   shoot(g, x, y);
+}
+
+
+/**
+ * Resolve queued clicks made before until (ns). sim_time is the
+ * time of the current simulation step. Drawing shows the state
+ * one step behind, so a click at sim_time + alpha * TICK_NS is
+ * tested against targets posed at alpha.
+ */
+static void resolve_clicks(struct game_t *g, long long sim_time, long long until)
+{
+   long long offset;
+   int i, n = 0;
+
+   for (i = 0; i < g->num_clicks; i++) {
+      if (g->clicks[i].t >= until) {
+         g->clicks[n++] = g->clicks[i];
+         continue;
+      }
+      offset = g->clicks[i].t - sim_time;
+      if (offset < 0) {
+         offset = 0;
+      } else if (offset > TICK_NS) {
+         offset = TICK_NS;
+      }
+      if (g->primary) {
+         replay_click(g->ticks, offset, g->clicks[i].x, g->clicks[i].y);
+      }
+      resolve_click(g, offset, g->clicks[i].x, g->clicks[i].y);
+   }
+   g->num_clicks = n;
+}
+
+
+/**
+ * Feed recorded events for the current step to the game. Returns
+ * false when the recording ends.
+ */
+static bool play_events(struct game_t *g)
+{
+   const struct replay_event_t *e;
+
+   while ((e = replay_peek()) && e->tick <= g->ticks) {
+      switch (e->type) {
+      case Replay_click:
+         resolve_click(g, e->offset, e->x, e->y);
+         break;
+      case Replay_key:
+         if (e->value == 'p') {
+            pause_pressed();
+         } else if (e->value == 'h') {
+            hud_pressed();
+         } else if (e->value == 't') {
+            timing_pressed();
+         }
+         break;
+      case Replay_quality:
+         if (e->value >= 0 && e->value <= VIDEO_QUALITY_MAX) {
+            set_quality(e->value);
+         }
+         break;
+      case Replay_level:
+         /* Taken by new_level() when this level is finished */
+         return true;
+      case Replay_end:
+         return false;
+      }
+      replay_pop();
+   }
+
+   return e != NULL;
+}
+
+
+/**
+ * One of the targets that can be shot and have been up min_age
+ * steps, picked at random. NULL if there is none.
+ */
+static struct target_t *pick_target(struct game_t *g, struct rng_t *r, int min_age)
+{
+   struct target_t *a, *pick = NULL;
+   int i, n = 0;
+
+   for (i = 0; i < g->lv->num_targets; i++) {
+      a = &g->lv->targets[i];
+      if (a->state > Dead && a->state < Hit && a->age >= min_age &&
+          rng_below(r, ++n) == 0) {
+         pick = a;
+      }
+   }
+
+   return pick;
+}
+
+
+/* Somewhere up to spread pixels from the center of the circle of a */
+static void aim_at(struct target_t *a, struct rng_t *r, int spread, int *x, int *y)
+{
+   *x = a->x + (target_w(a) >> 1) + a->targ_tx;
+   *y = a->y + (target_h(a) >> 1) + a->targ_ty;
+   *x += rng_below(r, 2 * spread + 1) - spread;
+   *y += rng_below(r, 2 * spread + 1) - spread;
+}
+
+
+/* The simulated player's click for the current step, if any */
+static void batch_click(struct batch_worker_t *w)
+{
+   struct game_t *g = &w->game;
+   struct target_t *aim;
+   int x, y;
+
+   if (g->ticks % BATCH_AIM_STEPS) {
+      return;
+   }
+   if (batch_random) {
+      x = rng_below(&w->aim, 800);
+      y = rng_below(&w->aim, 600);
+      resolve_click(g, 0, x, y);
+      return;
+   }
+   if (g->mag_state == Reloading) {
+      return;
+   }
+   if (g->mag_bullets == 0) {
+      /* Click to reload */
+      shoot(g, 0, 0);
+      return;
+   }
+
+   /* Aim at one of the targets where they are now */
+   pose_targets(g, 0);
+   aim = pick_target(g, &w->aim, BATCH_REACT_STEPS);
+   if (!aim) {
+      return;
+   }
+   aim_at(aim, &w->aim, BATCH_SPREAD, &x, &y);
+   resolve_click(g, 0, x, y);
+}
+
+
+/* Play game n of the batch until its last level is finished */
+static void batch_game(struct batch_worker_t *w, int n)
+{
+   struct game_t *g = &w->game;
+   bool finished;
+   int score;
+
+   game_reset(g, batch_seed + n);
+   rng_seed(&w->aim, batch_seed + n, NUM_RANDOM);
+   g->level = batch_only ? batch_only - 1 : 0;
+
+   while (new_level(g)) {
+      g->stats = &w->stats[g->level - 1];
+      g->stats->played++;
+      score = g->total_score;
+      do {
+         batch_click(w);
+         count_time(g);
+         reload_magazine(g);
+         finished = move_targets(g);
+         g->ticks++;
+      } while (!finished);
+      batch_score[g->level * batch_games + n] = g->total_score - score;
+      batch_first_spawn[g->level * batch_games + n] = g->first_spawn;
+      end_level(g);
+      if (batch_only) {
+         break;
+      }
+   }
+   g->stats = NULL;
+   batch_score[n] = g->total_score;
+   w->steps += g->ticks;
+}
+
+
+static int batch_main(void *data)
+{
+   struct batch_worker_t *w = (struct batch_worker_t *)data;
+   int n;
+
+   while ((n = __sync_fetch_and_add(&batch_next, 1)) < batch_games) {
+      batch_game(w, n);
+   }
+
+   return 0;
+}
+
+
+/**
+ * Read levels first..last for w to play, stopping at the first
+ * missing one. Return the number of the last level read.
+ */
+static int batch_load(struct batch_worker_t *w, int first, int last)
+{
+   char levelstr[LEVEL_PNG_LEN];
+   int n;
+
+   for (n = first; n <= last; n++) {
+      w->levels[n - 1] = (struct level_t *)malloc(sizeof(struct level_t));
+      if (unlikely(!w->levels[n - 1])) {
+         WARN("malloc failed");
+         break;
+      }
+      level_filename(levelstr, n);
+      if (!level_read(w->levels[n - 1], levelstr)) {
+         free(w->levels[n - 1]);
+         w->levels[n - 1] = NULL;
+         break;
+      }
+   }
+   w->game.levels = w->levels;
+   w->game.num_levels = n - 1;
+
+   return n - 1;
+}
+
+
+static int cmp_int(const void *a, const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+
+/* Print the spread of the n values in v, sorted in place */
+static void print_spread(const char *name, int *v, int n, float unit)
+{
+   long long sum = 0;
+   int i;
+
+   if (n == 0) {
+      printf("  %-12s -\n", name);
+      return;
+   }
+   qsort(v, n, sizeof(int), cmp_int);
+   for (i = 0; i < n; i++) {
+      sum += v[i];
+   }
+   printf("  %-12s min %7.2f  p10 %7.2f  median %7.2f  p90 %7.2f  max %7.2f  mean %7.2f\n",
+          name, v[0] / unit, v[(n - 1) / 10] / unit, v[(n - 1) / 2] / unit,
+          v[(n - 1) * 9 / 10] / unit, v[n - 1] / unit, sum / (float)n / unit);
+}
+
+
+static void batch_report(struct batch_worker_t *workers, int threads, int level)
+{
+   static const char *rings[NUM_RINGS] = { "inner", "middle", "outer", "body", "miss" };
+   struct level_stats_t sum;
+   const char *name, *p;
+   int *first = &batch_first_spawn[level * batch_games];
+   int i, j, n = 0;
+   unsigned int shots = 0;
+
+   memset(&sum, 0, sizeof(sum));
+   for (i = 0; i < threads; i++) {
+      sum.played += workers[i].stats[level - 1].played;
+      sum.bonus_hits += workers[i].stats[level - 1].bonus_hits;
+      for (j = 0; j < NUM_TARGETS; j++) {
+         sum.spawns[j] += workers[i].stats[level - 1].spawns[j];
+      }
+      for (j = 0; j < NUM_RINGS; j++) {
+         sum.shots[j] += workers[i].stats[level - 1].shots[j];
+      }
+   }
+   if (!sum.played) {
+      return;
+   }
+   for (j = 0; j < NUM_RINGS; j++) {
+      shots += sum.shots[j];
+   }
+   /* Leave out games where nothing spawned */
+   for (i = 0; i < batch_games; i++) {
+      if (first[i] >= 0) {
+         first[n++] = first[i];
+      }
+   }
+
+   printf("LEVEL %d: %u games\n", level, sum.played);
+   print_spread("score", &batch_score[level * batch_games], batch_games, 1);
+   print_spread("1st spawn s", first, n, FPS);
+   if (n < batch_games) {
+      printf("  %-12s %d games\n", "no spawn", batch_games - n);
+   }
+   printf("  %-12s", "spawns/game");
+   for (j = 0; j < NUM_TARGETS; j++) {
+      /* png/bird.png -> bird */
+      name = workers[0].levels[level - 1]->tpng[j];
+      if ((p = strrchr(name, '/'))) {
+         name = p + 1;
+      }
+      p = strchr(name, '.');
+      printf(" %.*s %.2f", p ? (int)(p - name) : (int)strlen(name), name,
+             sum.spawns[j] / (float)sum.played);
+   }
+   printf("\n");
+   printf("  %-12s %.2f:", "shots/game", shots / (float)sum.played);
+   for (j = 0; j < NUM_RINGS; j++) {
+      printf(" %s %.1f%%", rings[j], shots ? 100.0f * sum.shots[j] / shots : 0.0f);
+   }
+   printf(", bonus ball %.1f%%\n", shots ? 100.0f * sum.bonus_hits / shots : 0.0f);
+}
+
+
+/**
+ * Play batch_games games from seed, seed + 1... with the simulated
+ * player and print how they went, per level. The result of each
+ * game only depends on its seed, not on the number of threads.
+ */
+static bool batch_run(uint64_t seed)
+{
+   struct batch_worker_t *workers;
+   int threads = batch_threads;
+   int first = batch_only ? batch_only : 1;
+   int last = batch_only ? batch_only : BATCH_MAX_LEVELS;
+   int i, n;
+   unsigned long long steps = 0;
+   long long t, t_load;
+   bool ret = false;
+
+   if (!threads) {
+      threads = 2;
+#ifdef _SC_NPROCESSORS_ONLN
+      threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   }
+   if (threads > BATCH_MAX_THREADS) {
+      threads = BATCH_MAX_THREADS;
+   }
+   if (threads > batch_games) {
+      threads = batch_games;
+   }
+   if (threads < 1) {
+      threads = 1;
+   }
+   if (first > BATCH_MAX_LEVELS) {
+      WARN("Level %d, max is %d", first, BATCH_MAX_LEVELS);
+      return false;
+   }
+
+   workers = (struct batch_worker_t *)calloc(threads, sizeof(struct batch_worker_t));
+   if (unlikely(!workers)) {
+      WARN("calloc failed");
+      return false;
+   }
+
+   /* Levels are read here, one thread at a time, the parser and
+    * the pack mapping are not thread safe */
+   t = profile_time();
+   for (i = 0; i < threads; i++) {
+      if (!game_start(&workers[i].game, seed, false)) {
+         goto out;
+      }
+      n = batch_load(&workers[i], first, last);
+      if (n < first) {
+         WARN("No level %d to play", first);
+         goto out;
+      }
+      /* The others read as many as the first */
+      last = n;
+   }
+   if (last == BATCH_MAX_LEVELS && !batch_only) {
+      WARN("Only the first %d levels are played", BATCH_MAX_LEVELS);
+   }
+
+   batch_score = (int *)calloc((last + 1) * batch_games, sizeof(int));
+   batch_first_spawn = (int *)calloc((last + 1) * batch_games, sizeof(int));
+   if (unlikely(!batch_score || !batch_first_spawn)) {
+      WARN("calloc failed");
+      goto out;
+   }
+
+   batch_seed = seed;
+   batch_next = 0;
+   t_load = profile_time() - t;
+   t = profile_time();
+   for (i = 0; i < threads; i++) {
+      workers[i].thread = SDL_CreateThread(batch_main, &workers[i]);
+      if (!workers[i].thread) {
+         /* Play the rest here instead */
+         batch_main(&workers[i]);
+      }
+   }
+   for (i = 0; i < threads; i++) {
+      if (workers[i].thread) {
+         SDL_WaitThread(workers[i].thread, NULL);
+      }
+      steps += workers[i].steps;
+   }
+   t = profile_time() - t;
+
+   printf("BATCH: %d games, seed %llu, %s player, %d threads\n", batch_games,
+          (unsigned long long)seed, batch_random ? "random" : "aiming", threads);
+   printf("BATCH: levels read in %.2f s, played in %.2f s, %.0f games/s, %.1f M steps/s\n",
+          t_load / 1e9, t / 1e9, batch_games / (t / 1e9), steps / (t / 1e3));
+   for (n = first; n <= last; n++) {
+      batch_report(workers, threads, n);
+   }
+   if (!batch_only) {
+      printf("GAME:\n");
+      print_spread("score", batch_score, batch_games, 1);
+   }
+
+   ret = true;
+
+out:
+
+   for (i = 0; i < threads; i++) {
+      game_stop(&workers[i].game);
+      for (n = 0; n < BATCH_MAX_LEVELS; n++) {
+         if (workers[i].levels[n]) {
+            level_free(workers[i].levels[n]);
+            free(workers[i].levels[n]);
+         }
+      }
+   }
+   free(workers);
+   free(batch_score);
+   free(batch_first_spawn);
+
+   return ret;
+}
+
+
+/**
+ * What a shot at (x, y) hits, without shooting: target << 4, the
+ * bonus ball << 3 and the ring, or -1 for nothing.
+ */
+static int hit_test(struct game_t *g, int x, int y)
+{
+   struct target_t *a;
+   enum ring_t ring;
+   bool ball;
+   int i;
+
+   for (i = 0; i < g->lv->num_targets; i++) {
+      a = &g->lv->targets[i];
+      if (a->state > Dead && a->state < Hit) {
+         ring = hit_target(g, a, x, y, &ball);
+         if (ring != Ring_miss || ball) {
+            return i << 4 | ball << 3 | ring;
+         }
+      }
+   }
+
+   return -1;
+}
+
+
+/* Set up the click load for frames frames, exits on failure */
+static void stress_start(uint64_t seed, unsigned int frames)
+{
+   rng_seed(&stress_rng, seed, NUM_RANDOM + 1);
+   stress_click = (struct click_t *)malloc(stress_clicks * sizeof(struct click_t));
+   stress_hit[0] = (int *)malloc(stress_clicks * sizeof(int));
+   stress_hit[1] = (int *)malloc(stress_clicks * sizeof(int));
+   stress_ns[0] = (int *)malloc(frames * sizeof(int));
+   stress_ns[1] = (int *)malloc(frames * sizeof(int));
+   stress_edge = (int *)malloc(STRESS_MAX_EDGES * 2 * sizeof(int));
+   if (unlikely(!stress_click || !stress_hit[0] || !stress_hit[1] ||
+                !stress_ns[0] || !stress_ns[1] || !stress_edge)) {
+      WARN("malloc failed");
+      exit(1);
+   }
+}
+
+
+/* Find pixels of the layers of g where they turn opaque */
+static void stress_find_edges(struct game_t *g)
+{
+   struct sprite_t *sprp;
+   int i, j, x, y;
+   int n = 0;
+   bool hit;
+
+   stress_lv = g->lv;
+   stress_edges = 0;
+   for (i = 0; i < NUM_LAYERS; i++) {
+      sprp = g->lv->layers[i].spr;
+      if (!sprp->spr) {
+         continue;
+      }
+      for (y = sprp->rect.y; y < sprp->rect.y + sprp->rect.h - 1; y++) {
+         for (x = sprp->rect.x; x < sprp->rect.x + sprp->rect.w - 1; x++) {
+            hit = sprp->sprite_collide(sprp, x, y);
+            if (hit == sprp->sprite_collide(sprp, x + 1, y) &&
+                hit == sprp->sprite_collide(sprp, x, y + 1)) {
+               continue;
+            }
+            /* Keep a random sample if there are too many */
+            j = n < STRESS_MAX_EDGES ? n : (int)rng_below(&stress_rng, n + 1);
+            n++;
+            if (j < STRESS_MAX_EDGES) {
+               stress_edge[j * 2] = x;
+               stress_edge[j * 2 + 1] = y;
+            }
+         }
+      }
+   }
+   stress_edges = n < STRESS_MAX_EDGES ? n : STRESS_MAX_EDGES;
+}
+
+
+/**
+ * Hit test stress_clicks clicks against the current step of g, by
+ * reading pixels and with hit masks, and check that they agree.
+ * The game itself is not changed.
+ */
+static void stress_frame(struct game_t *g)
+{
+   struct click_t *c;
+   struct target_t *a;
+   int i, j, path;
+   long long t;
+
+   if (stress_dist == Click_edge && g->lv != stress_lv) {
+      stress_find_edges(g);
+   }
+
+   /* Posed as resolve_click() does */
+   pose_targets(g, 0);
+   pose_waves(g, 0);
+
+   for (i = 0; i < stress_clicks; i++) {
+      c = &stress_click[i];
+      if (stress_dist == Click_seek && (a = pick_target(g, &stress_rng, 0))) {
+         aim_at(a, &stress_rng, STRESS_SPREAD, &c->x, &c->y);
+      } else if (stress_dist == Click_edge && stress_edges) {
+         j = rng_below(&stress_rng, stress_edges);
+         c->x = stress_edge[j * 2] + rng_below(&stress_rng, 3) - 1;
+         c->y = stress_edge[j * 2 + 1] + rng_below(&stress_rng, 3) - 1;
+      } else {
+         c->x = rng_below(&stress_rng, 800);
+         c->y = rng_below(&stress_rng, 600);
+      }
+   }
+
+   /* Take turns going first, so neither gets the warm caches */
+   for (j = 0; j < 2; j++) {
+      path = (stress_frames + j) & 1;
+      sprite_collide_masks(path == 1);
+      t = profile_time();
+      for (i = 0; i < stress_clicks; i++) {
+         stress_hit[path][i] = hit_test(g, stress_click[i].x, stress_click[i].y);
+      }
+      stress_ns[path][stress_frames] = profile_time() - t;
+   }
+   sprite_collide_masks(true);
+
+   for (i = 0; i < stress_clicks; i++) {
+      if (unlikely(stress_hit[0][i] != stress_hit[1][i])) {
+         if (stress_mismatches++ < 10) {
+            WARN("Click (%d, %d) hit %d reading pixels but %d with masks",
+                 stress_click[i].x, stress_click[i].y, stress_hit[0][i], stress_hit[1][i]);
+         }
+      }
+      if (stress_hit[0][i] >= 0) {
+         stress_hits++;
+      }
+   }
+   stress_frames++;
+}
+
+
+/* Print what the click load found, return false on mismatches */
+static bool stress_report(void)
+{
+   static const char *dists[] = { "uniform", "seek", "edge" };
+   static const char *paths[] = { "pixels", "masks" };
+   unsigned long long clicks = (unsigned long long)stress_clicks * stress_frames;
+   long long ns;
+   unsigned int i;
+   int path;
+
+   if (!stress_frames) {
+      return true;
+   }
+   printf("CLICKS: %d per frame, %s, %u frames, %.1f%% hit\n", stress_clicks,
+          dists[stress_dist], stress_frames, 100.0 * stress_hits / clicks);
+   for (path = 0; path < 2; path++) {
+      for (ns = 0, i = 0; i < stress_frames; i++) {
+         ns += stress_ns[path][i];
+      }
+      printf("CLICKS: %s, %.2f M hit tests/s, %.0f ns each\n", paths[path],
+             clicks / (ns / 1e3), ns / (double)clicks);
+      print_spread("us/frame", stress_ns[path], stress_frames, 1000);
+   }
+   printf("CLICKS: %llu mismatches\n", stress_mismatches);
+
+   free(stress_click);
+   free(stress_hit[0]);
+   free(stress_hit[1]);
+   free(stress_ns[0]);
+   free(stress_ns[1]);
+   free(stress_edge);
+
+   return stress_mismatches == 0;
+}
+
+
+static void usage(const char *name)
+{
+   printf("Usage: %s [-w] [-x] [-i] [-d <dir>] [-S <seed>] [-R|-P <replay>] [-b <frames> [-n]] [-B <games> [-j <threads>] [-r] [-L <level>]] [-C <clicks> [-D <where>]] [-G <dir> [-U] [-E <dB>]] [-T <trace.json>] [-f <fps>] [-s <frames>] [-q <quality>]\n", name);
+   printf("       %s -c <level.txt> <level.lvl>\n", name);
+   printf("       %s -p <pack> <level1> <level2>...\n", name);
+   printf("  -w  Reload level when it or its pngs change\n");
+   printf("  -T  Write Chrome trace events to file at exit\n");
+   printf("  -x  Draw crosshair in software, just before each flip\n");
+   printf("  -i  Read mouse and keys in a thread of their own\n");
+   printf("  -d  Read levels from dir instead of levels\n");
+   printf("  -S  Random seed, the same seed spawns the same targets\n");
+   printf("  -R  Record seed, levels and input to replay file\n");
+   printf("  -P  Play back replay file and check the score\n");
+   printf("  -b  Benchmark, run frames without window or sleeping\n");
+   printf("  -n  Benchmark without drawing\n");
+   printf("  -B  Play games from the seed on, without window, and print statistics\n");
+   printf("  -j  Threads for -B (default one per core)\n");
+   printf("  -r  Click at random in -B games instead of aiming at targets\n");
+   printf("  -L  Play only this level in -B games\n");
+   printf("  -C  Hit test clicks each frame, without window, with and without hit masks\n");
+   printf("  -D  Where -C clicks: uniform (default), seek targets or edge of layers\n");
+   printf("  -G  Compare every %dth frame of -b with the golden frames in dir\n", GOLDEN_EVERY);
+   printf("  -U  Write the golden frames for -G instead of comparing\n");
+   printf("  -E  PSNR smoothed frames must reach, 0 = exact (default %.0f)\n", GOLDEN_PSNR);
+   printf("  -f  Frames drawn per second (default %d)\n", FPS);
+   printf("  -q  Fixed quality 0-%d instead of adapting to speed\n", VIDEO_QUALITY_MAX);
+   printf("  -s  Max frames in a row to skip when behind, 0 = never (default %d)\n", MAX_FRAME_SKIP);
+   printf("  -c  Compile level\n");
+   printf("  -p  Write level pack\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+   int i;
+   bool watch = false;
+   bool finished, drawn;
+   int skip = 0;
+   int quality = -1;
+   long long now, sim_time;
+   long long t;
+   const char *record = NULL;
+   bool ok;
+   uint64_t seed = time(NULL);
+   struct game_t game;
+   struct game_t *g = &game;
+
+   /* carnival -c <level.txt> <level.lvl> compiles a level and exits */
+   if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+      exit(compile_level(argv[2], argv[3]) ? 0 : 1);
+   }
+   /* carnival -p <pack> <level1> <level2>... writes a level pack and exits */
+   if (argc >= 4 && strcmp(argv[1], "-p") == 0) {
+      exit(pack_levels(argv[2], argc - 3, &argv[3]) ? 0 : 1);
+   }
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-w") == 0) {
+         watch = true;
+      } else if (strcmp(argv[i], "-x") == 0) {
+         custom_cursor_software(true);
+      } else if (strcmp(argv[i], "-i") == 0) {
+         threaded_input = true;
+         video_event_thread(true);
+      } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+         level_dir = argv[++i];
+      } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+         seed = strtoull(argv[++i], NULL, 0);
+      } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+         record = argv[++i];
+      } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+         if (!replay_play(argv[++i], &seed)) {
+            exit(1);
+         }
+      } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         bench_frames = atoi(argv[++i]);
+         video_headless();
+      } else if (strcmp(argv[i], "-n") == 0) {
+         bench_draw = false;
+      } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         batch_games = atoi(argv[++i]);
+         video_headless();
+      } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         batch_threads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-r") == 0) {
+         batch_random = true;
+      } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         batch_only = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         stress_clicks = atoi(argv[++i]);
+         video_headless();
+      } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+         i++;
+         if (strcmp(argv[i], "uniform") == 0) {
+            stress_dist = Click_uniform;
+         } else if (strcmp(argv[i], "seek") == 0) {
+            stress_dist = Click_seek;
+         } else if (strcmp(argv[i], "edge") == 0) {
+            stress_dist = Click_edge;
+         } else {
+            usage(argv[0]);
+            exit(1);
+         }
+      } else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc) {
+         golden_dir = argv[++i];
+      } else if (strcmp(argv[i], "-U") == 0) {
+         golden_update = true;
+      } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+         golden_psnr = atof(argv[++i]);
+      } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+         trace_start(argv[++i]);
+      } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+         render_fps = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+         max_skip = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc &&
+                 atoi(argv[i + 1]) >= 0 && atoi(argv[i + 1]) <= VIDEO_QUALITY_MAX) {
+         video_fix_quality(atoi(argv[++i]));
+      } else {
+         usage(argv[0]);
+         exit(1);
+      }
+   }
+
+   if (stress_clicks && !bench_frames) {
+      bench_frames = STRESS_FRAMES;
+   }
+   /* Only headless runs draw the same frames every time */
+   if (golden_dir && (!bench_frames || !bench_draw)) {
+      usage(argv[0]);
+      exit(1);
+   }
+   if (golden_dir) {
+      golden_start(golden_dir, golden_update, golden_psnr);
+   }
+
    /* Initialize game */
    game_init(800, 600);
 
-   if (!new_level()) {
+   if (bench_frames || batch_games) {
+      /* The governor would make runs incomparable */
+      video_fix_quality(video_quality());
+   }
+
+   if (batch_games) {
+      ok = batch_run(seed);
+      goto out;
+   }
+
+   if (record && !replay_record(record, seed)) {
+      exit(1);
+   }
+
+   if (!game_start(g, seed, true)) {
       exit(1);
    }
+   played = g;
+
+   if (stress_clicks) {
+      stress_start(seed, bench_frames);
+   }
+
+   if (!new_level(g)) {
+      exit(1);
+   }
+
+   /* Hit tests use the rotated sprites, so quality is part of a replay */
+   replay_quality(g->ticks, video_quality());
+
+   if (watch) {
+      level_watch_start();
+   }
 
-   /* Main game loop */
+   /* Main game loop. The simulation advances in fixed steps of
+    * TICK_NS, as many as fit in the time since the last frame.
+    * sim_time is the time of the current step.
+    */
+   sim_time = video_time_ns();
+   t = profile_time();
    while (!quit) {
 
       /* Check for mouse and key events */
       handle_events();
+      t = profile_phase(Phase_events, t);
 
-      /* Count down time once every second */
-      count_time();
+      /* Apply edited level files between frames */
+      level_watch_poll();
 
-      if (likely(!pause)) {
-         if(unlikely(move_targets())) {
-            /* Level finished */
-            free_level();
-            if (!new_level()) {
-               quit = true;
-            }
-         } else {
-            draw_layers();
+      if (unlikely(bench_frames)) {
+         /* One step per frame, as fast as they can be made */
+         now = sim_time + TICK_NS;
+      } else {
+         now = video_time_ns();
+      }
+      if (unlikely(paused)) {
+         sim_time = now;
+      } else if (unlikely(now - sim_time > MAX_TICKS_BEHIND * TICK_NS)) {
+         /* Too slow to keep up, let the game slow down */
+         sim_time = now - MAX_TICKS_BEHIND * TICK_NS;
+      }
+
+      finished = false;
+      drawn = false;
+      for (;;) {
+         /* Clicks made before the next step see this one */
+         resolve_clicks(g, sim_time, sim_time + TICK_NS);
+         if (unlikely(replay_playing()) && !play_events(g)) {
+            quit = true;
+            break;
          }
+         if (finished || now - sim_time < TICK_NS) {
+            break;
+         }
+         /* Count down time once every second */
+         count_time(g);
+         reload_magazine(g);
+         finished = move_targets(g);
+         g->ticks++;
+         sim_time += TICK_NS;
       }
+      t = profile_phase(Phase_move, t);
 
-      /* Show new frame */
-      video_flip();
+      if (unlikely(stress_clicks) && !finished && stress_frames < bench_frames) {
+         /* Not part of any phase */
+         stress_frame(g);
+         t = profile_time();
+      }
+
+      if (unlikely(finished)) {
+         /* Level finished */
+         profile_print_level(g->level);
+         end_level(g);
+         if (!new_level(g)) {
+            quit = true;
+         }
+         /* Do not catch up the time spent loading */
+         if (!bench_frames) {
+            sim_time = video_time_ns();
+         }
+         g->num_clicks = 0;
+      } else if (likely(!paused && bench_draw)) {
+         if (unlikely(skip < max_skip && video_frame_late())) {
+            /* Behind, let the simulation catch up before drawing */
+            video_skip_frame();
+            skip++;
+            t = profile_time();
+            continue;
+         }
+         skip = 0;
+         if (unlikely(video_quality() != quality) && !replay_playing()) {
+            quality = video_quality();
+            set_quality(quality);
+            replay_quality(g->ticks, quality);
+         }
+         draw_layers(g, (float)(now - sim_time) / TICK_NS);
+         drawn = true;
+         t = profile_phase(Phase_draw, t);
+         if (unlikely(golden_dir) && frames % GOLDEN_EVERY == 0) {
+            /* Before the crosshair, not part of any phase */
+            golden_frame(screen, frames, smoothed);
+            t = profile_time();
+         }
+      }
+
+      /* Show new frame, software crosshair last. If only the
+       * crosshair moved it updates just its own rects. */
+      if (likely(bench_draw)) {
+         if (!custom_cursor_draw(drawn || finished)) {
+            video_flip();
+         }
+      }
+      profile_photon(frames);
+      t = profile_phase(Phase_flip, t);
 
       /* Sleep until next frame */
       video_fps_sleep();
+      t = profile_phase(Phase_sleep, t);
+
+      if (unlikely(bench_frames && frames >= bench_frames)) {
+         quit = true;
+      }
    }
 
    video_average_fps();
+   profile_print_level(g->level);
+   profile_print();
+   if (bench_frames) {
+      profile_print_throughput();
+   }
 
    /* Game finished. */
-   printf("TOTAL SCORE: %d\n", total_score);
+   printf("TOTAL SCORE: %d\n", g->total_score);
+   printf("SEED: %llu\n", (unsigned long long)g->seed);
+   ok = replay_close(g->ticks, g->total_score);
+   if (!stress_report()) {
+      ok = false;
+   }
+   if (!golden_close()) {
+      ok = false;
+   }
+
+   game_stop(g);
+
+out:
 
    game_cleanup();
+   trace_dump();
 
-   exit(0);
+   exit(ok ? 0 : 1);
 }
 
 
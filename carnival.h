@@ -52,6 +52,8 @@
 
 /* Target is specified in config.h */
 #include "config.h"
+/* Timing and trace markers */
+#include "profile.h"
 
 /* For now SDL is the only target, this may change.
  * If more targets are added, move all SDL files into
@@ -104,7 +106,9 @@
 /* Callbacks for keys and mouse */
 void escape_pressed(void);
 void pause_pressed(void);
-void mouse_clicked(int x, int y);
+void timing_pressed(void);
+void hud_pressed(void);
+void mouse_clicked(int x, int y, long long t);
 
 
 /**
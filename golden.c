@@ -0,0 +1,395 @@
+/**
+ * @file golden.c
+ * @brief Golden frames, regression checks for the renderer.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <png.h>
+
+#include "carnival.h"
+#include "golden.h"
+
+
+/* Golden frames are 8 bit RGB png files, dir/frameNNNNN.png */
+#define GOLDEN_NAME_LEN 256
+
+/* Per channel difference a differing pixel needs to be drawn in full red */
+#define DIFF_FULL 32
+
+
+/* ----------------------------------------------
+ * Local variables
+ * ----------------------------------------------
+ */
+
+static const char *golden_dir = NULL;
+static bool golden_update = false;
+static float golden_psnr = 0;
+
+static unsigned int compared = 0;
+static unsigned int failed = 0;
+static unsigned int written = 0;
+static bool broken = false;
+
+
+/* ----------------------------------------------
+ * Local functions
+ * ----------------------------------------------
+ */
+
+static void frame_name(char *name, unsigned int frame, const char *suffix)
+{
+   snprintf(name, GOLDEN_NAME_LEN, "%s/frame%05u%s.png", golden_dir, frame, suffix);
+}
+
+
+/* Copy of s as packed RGB, w * h * 3 bytes. NULL if out of memory. */
+static Uint8 *surface_rgb(SDL_Surface *s)
+{
+   Uint8 *rgb, *dst;
+   Uint8 *row, *p;
+   Uint32 pixel;
+   int x, y;
+   int bpp = s->format->BytesPerPixel;
+
+   rgb = (Uint8 *)malloc(s->w * s->h * 3);
+   if (unlikely(!rgb)) {
+      return NULL;
+   }
+
+   if (SDL_MUSTLOCK(s)) {
+      SDL_LockSurface(s);
+   }
+   dst = rgb;
+   for (y = 0; y < s->h; y++) {
+      row = (Uint8 *)s->pixels + y * s->pitch;
+      for (x = 0; x < s->w; x++) {
+         p = row + x * bpp;
+         switch (bpp) {
+         case 1:
+            pixel = *p;
+            break;
+         case 2:
+            pixel = *(Uint16 *)p;
+            break;
+         case 3:
+            if (SDL_BYTEORDER == SDL_BIG_ENDIAN) {
+               pixel = p[0] << 16 | p[1] << 8 | p[2];
+            } else {
+               pixel = p[0] | p[1] << 8 | p[2] << 16;
+            }
+            break;
+         default:
+            pixel = *(Uint32 *)p;
+            break;
+         }
+         SDL_GetRGB(pixel, s->format, &dst[0], &dst[1], &dst[2]);
+         dst += 3;
+      }
+   }
+   if (SDL_MUSTLOCK(s)) {
+      SDL_UnlockSurface(s);
+   }
+
+   return rgb;
+}
+
+
+/* Read an RGB png file. Returns NULL if missing or not RGB. */
+static Uint8 *read_rgb(const char *filename, int *w, int *h)
+{
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytepp row_pointers;
+   int y;
+   /* volatile, png errors longjmp back here */
+   Uint8 * volatile rgb = NULL;
+
+   fp = fopen(filename, "rb");
+   if (!fp) {
+      return NULL;
+   }
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (unlikely(!png_ptr)) {
+      goto out_close;
+   }
+   info_ptr = png_create_info_struct(png_ptr);
+   if (unlikely(!info_ptr)) {
+      png_destroy_read_struct(&png_ptr, NULL, NULL);
+      goto out_close;
+   }
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      WARN("%s: png error", filename);
+      free(rgb);
+      rgb = NULL;
+      goto out;
+   }
+   png_init_io(png_ptr, fp);
+   png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_STRIP_ALPHA |
+                PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL);
+
+   if (png_get_color_type(png_ptr, info_ptr) != PNG_COLOR_TYPE_RGB) {
+      WARN("%s: not an RGB png file", filename);
+      goto out;
+   }
+   *w = png_get_image_width(png_ptr, info_ptr);
+   *h = png_get_image_height(png_ptr, info_ptr);
+   row_pointers = png_get_rows(png_ptr, info_ptr);
+
+   rgb = (Uint8 *)malloc(*w * *h * 3);
+   if (unlikely(!rgb)) {
+      goto out;
+   }
+   for (y = 0; y < *h; y++) {
+      memcpy(rgb + y * *w * 3, row_pointers[y], *w * 3);
+   }
+
+out:
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+out_close:
+   fclose(fp);
+
+   return rgb;
+}
+
+
+static bool write_rgb(const char *filename, Uint8 *rgb, int w, int h)
+{
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   int y;
+   volatile bool ok = false;
+
+   fp = fopen(filename, "wb");
+   if (!fp) {
+      WARN("Could not write %s", filename);
+      return false;
+   }
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (unlikely(!png_ptr)) {
+      goto out_close;
+   }
+   info_ptr = png_create_info_struct(png_ptr);
+   if (unlikely(!info_ptr)) {
+      png_destroy_write_struct(&png_ptr, NULL);
+      goto out_close;
+   }
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      WARN("%s: png error", filename);
+      goto out;
+   }
+   png_init_io(png_ptr, fp);
+   png_set_IHDR(png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+   png_write_info(png_ptr, info_ptr);
+   for (y = 0; y < h; y++) {
+      png_write_row(png_ptr, rgb + y * w * 3);
+   }
+   png_write_end(png_ptr, NULL);
+   ok = true;
+
+out:
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+out_close:
+   fclose(fp);
+
+   return ok;
+}
+
+
+/* Differing pixels in red, the rest a dimmed copy of gold */
+static void make_diff(Uint8 *diff, const Uint8 *gold, const Uint8 *rgb, int n)
+{
+   int i, c, d, max;
+
+   for (i = 0; i < n; i++, diff += 3, gold += 3, rgb += 3) {
+      max = 0;
+      for (c = 0; c < 3; c++) {
+         d = abs(gold[c] - rgb[c]);
+         if (d > max) {
+            max = d;
+         }
+      }
+      if (max) {
+         diff[0] = 128 + (max >= DIFF_FULL ? 127 : max * 127 / DIFF_FULL);
+         diff[1] = 0;
+         diff[2] = 0;
+      } else {
+         diff[0] = gold[0] >> 2;
+         diff[1] = gold[1] >> 2;
+         diff[2] = gold[2] >> 2;
+      }
+   }
+}
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+void golden_start(const char *dir, bool update, float psnr)
+{
+   golden_dir = dir;
+   golden_update = update;
+   golden_psnr = psnr;
+}
+
+
+void golden_frame(SDL_Surface *s, unsigned int frame, bool smooth)
+{
+   char name[GOLDEN_NAME_LEN];
+   Uint8 *rgb, *gold, *diff;
+   int w, h, i, n;
+   int differing = 0;
+   double sq = 0, mse, psnr;
+   bool pass;
+
+   if (!golden_dir) {
+      return;
+   }
+
+   rgb = surface_rgb(s);
+   if (unlikely(!rgb)) {
+      WARN("Out of memory");
+      broken = true;
+      return;
+   }
+
+   frame_name(name, frame, "");
+   if (golden_update) {
+      if (write_rgb(name, rgb, s->w, s->h)) {
+         written++;
+      } else {
+         broken = true;
+      }
+      goto out;
+   }
+
+   compared++;
+   gold = read_rgb(name, &w, &h);
+   if (!gold) {
+      printf("GOLDEN: frame %u: no %s, write it with -U\n", frame, name);
+      failed++;
+      goto out;
+   }
+   if (w != s->w || h != s->h) {
+      printf("GOLDEN: frame %u: %dx%d, golden frame is %dx%d\n", frame, s->w, s->h, w, h);
+      failed++;
+      goto out_gold;
+   }
+
+   n = w * h;
+   for (i = 0; i < n * 3; i += 3) {
+      int dr = rgb[i] - gold[i];
+      int dg = rgb[i + 1] - gold[i + 1];
+      int db = rgb[i + 2] - gold[i + 2];
+
+      if (dr || dg || db) {
+         differing++;
+         sq += dr * dr + dg * dg + db * db;
+      }
+   }
+   if (!differing) {
+      goto out_gold;
+   }
+
+   mse = sq / (n * 3);
+   psnr = 10 * log10(255.0 * 255.0 / mse);
+   /* Nearest neighbour output has no rounding to hide behind */
+   pass = smooth && golden_psnr > 0 && psnr >= golden_psnr;
+   printf("GOLDEN: frame %u: %d pixels differ, PSNR %.1f dB%s\n",
+          frame, differing, psnr, pass ? ", within tolerance" : "");
+   if (pass) {
+      goto out_gold;
+   }
+   failed++;
+
+   frame_name(name, frame, ".new");
+   if (!write_rgb(name, rgb, w, h)) {
+      broken = true;
+   }
+   diff = (Uint8 *)malloc(n * 3);
+   if (likely(diff)) {
+      make_diff(diff, gold, rgb, n);
+      frame_name(name, frame, ".diff");
+      if (!write_rgb(name, diff, w, h)) {
+         broken = true;
+      }
+      free(diff);
+   }
+
+out_gold:
+   free(gold);
+out:
+   free(rgb);
+}
+
+
+bool golden_close(void)
+{
+   if (!golden_dir) {
+      return true;
+   }
+
+   if (golden_update) {
+      printf("GOLDEN: wrote %u frames to %s\n", written, golden_dir);
+   } else {
+      printf("GOLDEN: %u frames compared, %u failed\n", compared, failed);
+   }
+   golden_dir = NULL;
+
+   return !failed && !broken && (compared || written);
+}
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,84 @@
+#ifndef __GOLDEN_H
+#define __GOLDEN_H
+
+/**
+ * @file golden.h
+ * @brief Compare drawn frames with stored golden frames.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdbool.h>
+#include <SDL.h>
+
+
+/* ----------------------------------------------
+ * Exported functions from golden.c
+ * ----------------------------------------------
+ */
+
+/**
+ * Start comparing frames with the golden ones in dir, or with
+ * update write them there instead. Smoothed frames pass with a PSNR
+ * of at least psnr dB, 0 asks for exact matches there too.
+ */
+void golden_start(const char *dir, bool update, float psnr);
+
+/**
+ * Compare or write surface s as frame number frame. Frames drawn
+ * without smoothing must match the golden frame exactly. A frame
+ * that differs is written next to the golden one as frameNNNNN.new.png
+ * together with frameNNNNN.diff.png, which shows the differing pixels
+ * in red over a dimmed copy of the golden frame.
+ */
+void golden_frame(SDL_Surface *s, unsigned int frame, bool smooth);
+
+/**
+ * Print how many frames were compared and failed.
+ * Returns false if any frame differed, could not be read or written.
+ */
+bool golden_close(void);
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
+
+#endif  /* __GOLDEN_H */
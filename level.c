@@ -46,29 +46,117 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <math.h>
+#include <zlib.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <sys/mman.h>
 #endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "carnival.h"
 #include "sdl_sprite.h"
 #include "level.h"
 
-/* Targets */
-static struct sprite_t tspr[NUM_TARGETS];
-struct target_t targets[NUM_TARGETS];
+/* Level being played and staging slot for the preloader */
+static struct level_t slots[2];
+static struct level_t *current = &slots[0];
+static struct level_t *staging = &slots[1];
+
+/* Preloader state */
+static SDL_Thread *preload_thread = NULL;
+static char preload_name[64];
+static bool preload_ok = false;
+static size_t preload_max_bytes = 0;
+
+/* Currently mapped level pack. The main thread waits for the
+ * preloader before anything that may read a pack level.
+ */
+static struct mapping_t pack;
+static char pack_name[LEVEL_PNG_LEN];
+
+/* File name of current level */
+static char current_name[LEVEL_PNG_LEN];
 
-/* Layers */
-static struct sprite_t lspr[NUM_LAYERS];
-struct layer_t layers[NUM_LAYERS];
+/* Hot reload, directories of the level file and its pngs are watched */
+#define WATCH_DIRS 8
+static int watch_fd = -1;
+static int watch_wd[WATCH_DIRS];
+static char watch_dir[WATCH_DIRS][LEVEL_PNG_LEN];
+static int watch_dirs = 0;
 
-int bg_x;
-int bg_y;
 
 /* ------------- */
 
+/* Compiled level format, written by compile_level():
+ *
+ * struct level_header_t
+ * struct level_layer_rec_t  [NUM_LAYERS]
+ * struct level_target_rec_t [NUM_TARGETS]
+ *
+ * Props are stored as they are in memory with derived geometry
+ * already calculated, so the file is only valid for binaries with
+ * the same struct prop_t layout. Bump LEVEL_VERSION when it changes.
+ */
+#define LEVEL_MAGIC "CLVL"
+#define LEVEL_VERSION 2
+
+struct level_header_t {
+   char magic[4];
+   Uint32 version;
+   Uint32 prop_size;
+   Uint32 num_layers;
+   Uint32 num_targets;
+};
+
+struct level_layer_rec_t {
+   char png[LEVEL_PNG_LEN];
+   Sint32 x, y;
+};
+
+struct level_target_rec_t {
+   char png[LEVEL_PNG_LEN];
+   struct prop_t prop;
+};
+
+#define LEVEL_BINARY_SIZE (NUM_LAYERS * sizeof(struct level_layer_rec_t) + \
+                           NUM_TARGETS * sizeof(struct level_target_rec_t))
+
+/* Level pack, written by pack_levels():
+ *
+ * struct pack_header_t
+ * struct pack_entry_t [num_levels]
+ * zlib compressed level files (text or compiled)
+ *
+ * Entry n - 1 is level n, offsets are from start of file.
+ */
+#define PACK_MAGIC "CPAK"
+#define PACK_VERSION 1
+
+struct pack_header_t {
+   char magic[4];
+   Uint32 version;
+   Uint32 num_levels;
+};
+
+struct pack_entry_t {
+   Uint32 offset;
+   Uint32 clen;
+   Uint32 ulen;
+};
+
+/* A read only file mapping */
+struct mapping_t {
+   char *mem;
+   size_t size;
+   int fd;
+#ifdef _WIN32
+   HANDLE fhmap;
+#endif
+};
+
 enum sect_t {
    S_Undef = 0,
    S_Layers,
@@ -163,6 +251,7 @@ static struct propname_t pnames[] = {
    { "flag_x",         Int    }, /* Flag coordinates relative upper left */
    { "flag_y",         Int    },
    { "flag_extra_fi",  Int    }, /* Flag start angle */
+   { "count",          Int    }, /* Instances alive at the same time */
    { NULL,             0      }
 };
 
@@ -200,21 +289,20 @@ enum propnum_t {
    Targ_r_inner,
    Flag_x,
    Flag_y,
-   Flag_extra_fi
+   Flag_extra_fi,
+   Count
 };
 
 
-static int line;
-
 
 #define MAX_VALUE_SIZE 64
-/* Eat whitespace, newlines and comments */
-static inline char *eat_whitespace_and_comments(char *p)
+/* Eat whitespace, newlines and comments, counting lines in *line */
+static inline char *eat_whitespace_and_comments(char *p, int *line)
 {
    do {
       while (*p == ' ' || *p == '\t' || *p == '\n') {
          if (*p == '\n') {
-            line++;
+            (*line)++;
          }
          p++;
       }
@@ -247,12 +335,12 @@ static inline char *eat_whitespace(char *p)
 }
 
 
-/* Init center of target, angle and radius */
-static void init_properties(struct prop_t *p)
+/* Init center of target, angle and radius. w, h = sprite dimensions */
+static void init_properties(struct prop_t *p, int w, int h)
 {
    /* Calculate cx,cy as distance from center of sprite to center of target */
-   p->targ_cx = p->targ_x - (sprite_width(*(p->spr)) >> 1);
-   p->targ_cy = p->targ_y - (sprite_height(*(p->spr)) >> 1);
+   p->targ_cx = p->targ_x - (w >> 1);
+   p->targ_cy = p->targ_y - (h >> 1);
 
    /* Check if cx,cy is exactly at center (to avoid division by zero) */
    if (unlikely(p->targ_cx == 0 && p->targ_cy == 0)) {
@@ -272,8 +360,8 @@ static void init_properties(struct prop_t *p)
    }
 
    /* Do the same calculation with flag connection point */
-   p->flag_cx = p->flag_x - (sprite_width(*(p->spr)) >> 1);
-   p->flag_cy = p->flag_y - (sprite_height(*(p->spr)) >> 1);
+   p->flag_cx = p->flag_x - (w >> 1);
+   p->flag_cy = p->flag_y - (h >> 1);
    if (unlikely(p->flag_cx == 0 && p->flag_cy == 0)) {
       p->flag_r = 0;
       p->flag_fi = 0;
@@ -287,7 +375,20 @@ static void init_properties(struct prop_t *p)
 }
 
 
-static bool parse_level(char *strp)
+/* Keep track of decoded image memory, fail if the level grows too big */
+static bool account_sprite(struct level_t *lv, struct sprite_t *s)
+{
+   lv->bytes += sprite_size(s);
+   if (unlikely(lv->max_bytes && lv->bytes > lv->max_bytes)) {
+      WARN("Level needs more than %lu bytes of image memory",
+           (unsigned long)lv->max_bytes);
+      return false;
+   }
+   return true;
+}
+
+
+static bool parse_level(char *strp, struct level_t *lv)
 {
    int i;
    char *p = strp;
@@ -305,24 +406,31 @@ static bool parse_level(char *strp)
    int *arrp;
    struct prop_t *prop = NULL;
    bool layer;
-
-   line = 1;
+   /* Local, the preloader may parse while the main thread reloads */
+   int line = 1;
+   TRACE_SCOPE("parse_level");
 
    do {
 
       layer = false;
 
+      /* Preloading may be cancelled from the main thread */
+      if (unlikely(lv->cancel)) {
+         DBG("Parsing cancelled at line %d", line);
+         goto out;
+      }
+
       /* Search for next value or section */
-      p = eat_whitespace_and_comments(p);
+      p = eat_whitespace_and_comments(p, &line);
       if (!p) {
          /* Check if everything is parsed ok. */
          for (i = 0; i < NUM_LAYERS; i++) {
-            if (!layers[i].spr->spr || layers[i].x == -1 || layers[i].y == -1) {
+            if (!lv->lpng[i][0] || lv->layers[i].x == -1 || lv->layers[i].y == -1) {
                goto out;
             }
          }
          for (i = 0; i < NUM_TARGETS; i++) {
-            if (!targets[i].prop.spr->spr) {
+            if (!lv->tpng[i][0]) {
                goto out;
             }
          }
@@ -357,7 +465,9 @@ static bool parse_level(char *strp)
             if (sect == S_Target) {
                target++;
                DBG("\nTarget #%d", target + 1);
-               prop = &(targets[target].prop);
+               prop = &(lv->props[target]);
+               /* One of each kind unless count says otherwise */
+               prop->count = 1;
             }
          } else {
             WARN("Unknown section at line %d", line);
@@ -438,10 +548,8 @@ static bool parse_level(char *strp)
          switch(lnames[key].type) {
 
          case String:
-            if(!sprite_load_from_png(layers[key >> 1].spr, value, true)) {
-               WARN("sprite_load_from_png failed for %s", value);
-               goto out;
-            }
+            /* Loaded by load_sprites() when the whole file is parsed */
+            strcpy(lv->lpng[key >> 1], value);
             break;
 
          case Inta:
@@ -454,9 +562,9 @@ static bool parse_level(char *strp)
                valp = oldvalp;
                intv = strtol(valp, &oldvalp, 10);
                if (i == 0) {
-                  layers[key >> 1].x = intv;
+                  lv->layers[key >> 1].x = intv;
                } else if (i == 1) {
-                  layers[key >> 1].y = intv;
+                  lv->layers[key >> 1].y = intv;
                } else {
                   WARN("Parse error - invalid coordinates for layer %s at line %d",
                        lnames[key >> 1].name, line);
@@ -607,6 +715,14 @@ static bool parse_level(char *strp)
             DBG("Int Flag_extra_fi (%s) = %d", pnames[key].name, intv);
             prop->flag_extra_fi = intv;
             break;
+         case Count:
+            DBG("Int Count (%s) = %d", pnames[key].name, intv);
+            if (intv < 0 || intv > LEVEL_MAX_COUNT) {
+               WARN("Parse error - count must be 0-%d at line %d", LEVEL_MAX_COUNT, line);
+               goto out;
+            }
+            prop->count = intv;
+            break;
          default:
             WARN("Parse error. struct propname_t and enum propnum_t probably out of sync");
             goto out;
@@ -680,10 +796,7 @@ static bool parse_level(char *strp)
          break;
 
       case String:
-         if(!sprite_load_from_png(targets[target].prop.spr, value, true)) {
-            WARN("sprite_load_from_png failed for %s", value);
-            goto out;
-         }
+         strcpy(lv->tpng[target], value);
          break;
 
       default:
@@ -697,152 +810,1105 @@ static bool parse_level(char *strp)
 
 out:
 
-   if (!ret) {
-      /* Parsing failed, free level */
-      free_level();
-   } else {
-      /* Success! */
+   return ret;
+}
+
+
+/* Read a level compiled by compile_level(). The file is mapped, so
+ * records are copied straight out of mem. Derived geometry is
+ * already calculated.
+ */
+static bool parse_binary(char *mem, size_t size, struct level_t *lv)
+{
+   struct level_header_t *hdr = (struct level_header_t *)mem;
+   struct level_layer_rec_t *lrec;
+   struct level_target_rec_t *trec;
+   int i;
 
-      /* Last layer is background, coordinates are relative (0,0) */
-      bg_x = layers[NUM_LAYERS - 1].x;
-      bg_y = layers[NUM_LAYERS - 1].y;
-      sprite_set_pos(*layers[NUM_LAYERS - 1].spr, bg_x, bg_y);
-      /* All other coordinates are relative background */
-      for (i = 0; i < NUM_LAYERS - 1; i++) {
-         sprite_set_pos(*layers[i].spr, bg_x + layers[i].x, bg_y + layers[i].y);
+   if (size < sizeof(struct level_header_t) + LEVEL_BINARY_SIZE) {
+      WARN("Compiled level is truncated");
+      return false;
+   }
+   if (hdr->version != LEVEL_VERSION ||
+       hdr->prop_size != sizeof(struct prop_t) ||
+       hdr->num_layers != NUM_LAYERS ||
+       hdr->num_targets != NUM_TARGETS) {
+      WARN("Compiled level version %u doesn't match this binary, run make levels",
+           (unsigned int)hdr->version);
+      return false;
+   }
+
+   lrec = (struct level_layer_rec_t *)(hdr + 1);
+   for (i = 0; i < NUM_LAYERS; i++, lrec++) {
+      memcpy(lv->lpng[i], lrec->png, LEVEL_PNG_LEN);
+      lv->lpng[i][LEVEL_PNG_LEN - 1] = '\x0';
+      lv->layers[i].x = lrec->x;
+      lv->layers[i].y = lrec->y;
+   }
+   trec = (struct level_target_rec_t *)lrec;
+   for (i = 0; i < NUM_TARGETS; i++, trec++) {
+      memcpy(lv->tpng[i], trec->png, LEVEL_PNG_LEN);
+      lv->tpng[i][LEVEL_PNG_LEN - 1] = '\x0';
+      memcpy(&lv->props[i], &trec->prop, sizeof(struct prop_t));
+      lv->props[i].spr = &lv->tspr[i];
+      if (lv->props[i].count < 0 || lv->props[i].count > LEVEL_MAX_COUNT) {
+         WARN("Compiled level has %d of target %d", lv->props[i].count, i + 1);
+         return false;
       }
-      for (i = 0; i < NUM_TARGETS; i++) {
-         if(!sprite_load_from_png(&targets[i].scorespr, "png/skull.png", true)) {
-            WARN("sprite_load_from_png failed for %s", "png/skull.png");
-            ret = false;
-            goto out;
-         }
-         init_properties(&targets[i].prop);
-         targets[i].state = Dead;
+   }
+
+   return true;
+}
+
+
+/* Set screen position of all layers */
+static void place_layers(struct level_t *lv)
+{
+   int i;
+
+   /* Last layer is background, coordinates are relative (0,0) */
+   lv->bg_x = lv->layers[NUM_LAYERS - 1].x;
+   lv->bg_y = lv->layers[NUM_LAYERS - 1].y;
+   sprite_set_pos(*lv->layers[NUM_LAYERS - 1].spr, lv->bg_x, lv->bg_y);
+   /* All other coordinates are relative background */
+   for (i = 0; i < NUM_LAYERS - 1; i++) {
+      sprite_set_pos(*lv->layers[i].spr, lv->bg_x + lv->layers[i].x, lv->bg_y + lv->layers[i].y);
+   }
+}
+
+
+/* Allocate count instances of each kind of target, all Dead */
+static bool make_targets(struct level_t *lv)
+{
+   struct target_t *a;
+   int i, k, n = 0;
+
+   for (k = 0; k < NUM_TARGETS; k++) {
+      n += lv->props[k].count;
+   }
+   lv->targets = (struct target_t *)calloc(n ? n : 1, sizeof(struct target_t));
+   if (unlikely(!lv->targets)) {
+      WARN("calloc failed for %d targets", n);
+      return false;
+   }
+   lv->num_targets = n;
+
+   for (k = 0, a = lv->targets; k < NUM_TARGETS; k++) {
+      lv->first[k] = a - lv->targets;
+      for (i = 0; i < lv->props[k].count; i++, a++) {
+         memcpy(&a->prop, &lv->props[k], sizeof(struct prop_t));
+         /* Shares the sprite of the kind, see share_sprites() */
+         a->prop.spr = &a->spr;
+         a->kind = k;
+         a->state = Dead;
       }
-      /* Bonusspr and flags are same for all levels and
-       * handled by carnival.c (for now).
-       */
    }
+   lv->first[NUM_TARGETS] = n;
 
-   return ret;
+   return true;
 }
 
 
-/* Initializations */
-static void init_level(void)
+/* Free the targets of make_targets() and their score sprites */
+static void free_targets(struct level_t *lv)
 {
    int i;
+
+   for (i = 0; i < lv->num_targets; i++) {
+      sprite_unshare(&lv->targets[i].spr);
+      if (lv->targets[i].scorespr.spr) {
+         sprite_free(&lv->targets[i].scorespr);
+      }
+   }
+   free(lv->targets);
+   lv->targets = NULL;
+   lv->num_targets = 0;
+   memset(lv->first, 0, sizeof(lv->first));
+}
+
+
+/* Decode all sprites of a parsed level. Calculate derived
+ * geometry unless it came precalculated from a compiled level.
+ * Runs on the preloader thread, so the sprites are left as software
+ * surfaces for display_sprites() to convert.
+ */
+static bool load_sprites(struct level_t *lv, bool resolved)
+{
+   int i;
+   struct prop_t *prop;
+
+   lv->bytes = 0;
+
    for (i = 0; i < NUM_LAYERS; i++) {
-      memset(&lspr[i], 0, sizeof(struct sprite_t));
-      layers[i].spr = &lspr[i];
-      layers[i].x = -1;
-      layers[i].y = -1;
+      if (unlikely(lv->cancel)) {
+         return false;
+      }
+      if(!sprite_decode_png(lv->layers[i].spr, lv->lpng[i], true)) {
+         WARN("sprite_decode_png failed for %s", lv->lpng[i]);
+         return false;
+      }
+      if (!account_sprite(lv, lv->layers[i].spr)) {
+         return false;
+      }
    }
+
+   place_layers(lv);
+
    for (i = 0; i < NUM_TARGETS; i++) {
-      memset(&tspr[i], 0, sizeof(struct sprite_t));
-      targets[i].prop.spr = &tspr[i];
+      prop = &lv->props[i];
+      if (unlikely(lv->cancel)) {
+         return false;
+      }
+      if(!sprite_decode_png(prop->spr, lv->tpng[i], true)) {
+         WARN("sprite_decode_png failed for %s", lv->tpng[i]);
+         return false;
+      }
+      if (!account_sprite(lv, prop->spr)) {
+         return false;
+      }
+      if (!resolved) {
+         init_properties(prop, sprite_width(*(prop->spr)), sprite_height(*(prop->spr)));
+      }
    }
+   if(!sprite_decode_png(&lv->scorespr, "png/skull.png", true)) {
+      WARN("sprite_decode_png failed for %s", "png/skull.png");
+      return false;
+   }
+   if (!account_sprite(lv, &lv->scorespr)) {
+      return false;
+   }
+   /* Bonusspr and flags are same for all levels and
+    * handled by carnival.c (for now).
+    */
+
+   return make_targets(lv);
 }
 
 
-/* Free resources allocated by load_level */
-void free_level(void)
+/* Let each target draw the converted sprite of its kind, rotated
+ * on its own. Again after the sprite of a kind is replaced.
+ */
+static void share_sprites(struct level_t *lv)
+{
+   struct target_t *a;
+   int i;
+
+   for (i = 0; i < lv->num_targets; i++) {
+      a = &lv->targets[i];
+      sprite_unshare(&a->spr);
+      sprite_share(&a->spr, lv->props[a->kind].spr);
+   }
+}
+
+
+/* Convert the sprites load_sprites() decoded to the display format.
+ * Main thread only.
+ */
+static bool display_sprites(struct level_t *lv)
 {
    int i;
 
+   for (i = 0; i < NUM_LAYERS; i++) {
+      if (!sprite_display_format(lv->layers[i].spr)) {
+         return false;
+      }
+   }
    for (i = 0; i < NUM_TARGETS; i++) {
-      if (targets[i].prop.spr->spr) {
-         sprite_free(targets[i].prop.spr);
-         sprite_free(&targets[i].scorespr);
+      if (!sprite_display_format(lv->props[i].spr)) {
+         return false;
       }
    }
+   share_sprites(lv);
+
+   return sprite_display_format(&lv->scorespr);
+}
 
+
+/* Initializations */
+static void init_level(struct level_t *lv)
+{
+   int i;
    for (i = 0; i < NUM_LAYERS; i++) {
-      if (layers[i].spr->spr) {
-         sprite_free(layers[i].spr);
-      }
-      layers[i].x = -1;
-      layers[i].y = -1;
+      memset(&lv->lspr[i], 0, sizeof(struct sprite_t));
+      lv->layers[i].spr = &lv->lspr[i];
+      lv->layers[i].x = -1;
+      lv->layers[i].y = -1;
+   }
+   for (i = 0; i < NUM_TARGETS; i++) {
+      memset(&lv->tspr[i], 0, sizeof(struct sprite_t));
+      lv->props[i].spr = &lv->tspr[i];
    }
+   memset(&lv->scorespr, 0, sizeof(struct sprite_t));
+   lv->targets = NULL;
+   lv->num_targets = 0;
+   memset(lv->first, 0, sizeof(lv->first));
+   lv->bytes = 0;
+   lv->max_bytes = 0;
+   lv->cancel = false;
 }
 
 
-/* Open filename and call parse_level to parse file */
-bool load_level(const char *filename)
+/* Init both level slots first time */
+static void init_slots(void)
 {
-   struct stat statbuf;
-   bool ret = false;
-   int fd = open(filename, O_RDONLY);
-   char *mem;
-#ifdef _WIN32
-   HANDLE fh, fhmap;
-#endif
    static bool level_initiated = false;
 
-
-   /* Init level first time */
    if (!level_initiated) {
-      init_level();
+      init_level(&slots[0]);
+      init_level(&slots[1]);
       level_initiated = true;
    }
+}
+
 
-   if (fd < 0) {
+/* Map filename read only into memory */
+static bool map_file(const char *filename, struct mapping_t *m)
+{
+   struct stat statbuf;
+   bool ret = false;
+#ifdef _WIN32
+   HANDLE fh;
+#endif
+
+   m->fd = open(filename, O_RDONLY);
+   if (m->fd < 0) {
       perror(filename);
       goto out;
    }
 
-   if (fstat(fd, &statbuf) < 0) {
+   if (fstat(m->fd, &statbuf) < 0) {
       perror(filename);
       goto out2;
    }
+   m->size = statbuf.st_size;
 
 #ifdef _WIN32
-   fh = (HANDLE)_get_osfhandle(fd);
-   fhmap = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, statbuf.st_size, NULL);
-   if (!fhmap) {
+   fh = (HANDLE)_get_osfhandle(m->fd);
+   m->fhmap = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, m->size, NULL);
+   if (!m->fhmap) {
       WARN("CreateFileMapping failed");
       goto out2;
    }
-   mem = MapViewOfFile(fhmap, FILE_MAP_READ, 0, 0, 1);
-   if (!mem) {
+   m->mem = MapViewOfFile(m->fhmap, FILE_MAP_READ, 0, 0, 1);
+   if (!m->mem) {
       WARN("MapViewOfFile failed");
-      CloseHandle(fhmap);
+      CloseHandle(m->fhmap);
       goto out2;
    }
 #else
-   mem = mmap(0, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-   if (mem == MAP_FAILED) {
+   m->mem = mmap(0, m->size, PROT_READ, MAP_SHARED, m->fd, 0);
+   if (m->mem == MAP_FAILED) {
       perror(filename);
       goto out2;
    }
 #endif
 
-   if (!parse_level(mem)) {
+   ret = true;
+   goto out;
+
+out2:
+
+   close(m->fd);
+
+out:
+
+   if (!ret) {
+      m->mem = NULL;
+   }
+
+   return ret;
+}
+
+
+static void unmap_file(struct mapping_t *m)
+{
+   if (!m->mem) {
+      return;
+   }
+#ifdef _WIN32
+   UnmapViewOfFile(m->mem);
+   CloseHandle(m->fhmap);
+#else
+   munmap(m->mem, m->size);
+#endif
+   close(m->fd);
+   m->mem = NULL;
+}
+
+
+/* Parse level file in mem, text or compiled, into lv.
+ * If sprites is false, no png is loaded and derived geometry is
+ * calculated from the png headers instead (for the level compiler).
+ */
+static bool parse_mem(char *mem, size_t size, struct level_t *lv, bool sprites)
+{
+   bool ret = false;
+   bool resolved = false;
+   int i, w, h;
+
+   if (size >= 4 && memcmp(mem, LEVEL_MAGIC, 4) == 0) {
+      /* Compiled level */
+      if (!parse_binary(mem, size, lv)) {
+         WARN("parse_binary failed");
+         goto out;
+      }
+      resolved = true;
+   } else if (!parse_level(mem, lv)) {
       WARN("parse_level failed");
-      goto out3;
+      goto out;
+   }
+
+   if (sprites) {
+      if (!load_sprites(lv, resolved)) {
+         goto out;
+      }
+   } else if (!resolved) {
+      for (i = 0; i < NUM_TARGETS; i++) {
+         if (!sprite_png_size(lv->tpng[i], &w, &h)) {
+            goto out;
+         }
+         init_properties(&lv->props[i], w, h);
+      }
+   }
+
+   ret = true;
+
+out:
+
+   if (!ret) {
+      level_free(lv);
+   }
+
+   return ret;
+}
+
+
+/* Read level number n (from 1) of pack file packname. The pack stays
+ * mapped until another pack is used or level_pack_close() is called.
+ */
+static bool read_pack_level(const char *packname, int n, struct level_t *lv, bool sprites)
+{
+   struct pack_header_t *hdr;
+   struct pack_entry_t *e;
+   uLongf ulen;
+   char *buf;
+   bool ret = false;
+
+   if (!pack.mem || strcmp(packname, pack_name)) {
+      level_pack_close();
+      if (!map_file(packname, &pack)) {
+         goto out;
+      }
+      hdr = (struct pack_header_t *)pack.mem;
+      if (pack.size < sizeof(struct pack_header_t) ||
+          memcmp(hdr->magic, PACK_MAGIC, 4) ||
+          hdr->version != PACK_VERSION ||
+          pack.size < sizeof(struct pack_header_t) + hdr->num_levels * sizeof(struct pack_entry_t)) {
+         WARN("%s is not a level pack", packname);
+         unmap_file(&pack);
+         goto out;
+      }
+      snprintf(pack_name, sizeof(pack_name), "%s", packname);
+   }
+
+   hdr = (struct pack_header_t *)pack.mem;
+   if (n < 1 || n > (int)hdr->num_levels) {
+      /* All levels finished */
+      DBG("No level %d in %s", n, packname);
+      goto out;
+   }
+   e = (struct pack_entry_t *)(hdr + 1) + n - 1;
+   if ((size_t)e->offset + e->clen > pack.size) {
+      WARN("Level %d of %s is truncated", n, packname);
+      goto out;
+   }
+
+   /* One extra byte, the text parser wants a terminated string */
+   buf = (char *)malloc(e->ulen + 1);
+   if (!buf) {
+      WARN("malloc failed for level %d of %s", n, packname);
+      goto out;
+   }
+   ulen = e->ulen;
+   if (uncompress((Bytef *)buf, &ulen, (Bytef *)pack.mem + e->offset, e->clen) != Z_OK ||
+       ulen != e->ulen) {
+      WARN("Level %d of %s is corrupt", n, packname);
+      goto out2;
+   }
+   buf[ulen] = '\x0';
+
+   ret = parse_mem(buf, ulen, lv, sprites);
+
+out2:
+
+   free(buf);
+
+out:
+
+   return ret;
+}
+
+
+/* Read filename into lv. filename is either a loose level file or
+ * a pack entry, <pack>#<level number>.
+ */
+static bool read_level(const char *filename, struct level_t *lv, bool sprites)
+{
+   struct mapping_t m;
+   char packname[LEVEL_PNG_LEN];
+   const char *hash = strrchr(filename, '#');
+   bool ret;
+
+   if (hash) {
+      snprintf(packname, sizeof(packname), "%.*s", (int)(hash - filename), filename);
+      return read_pack_level(packname, atoi(hash + 1), lv, sprites);
+   }
+
+   if (!map_file(filename, &m)) {
+      return false;
+   }
+   ret = parse_mem(m.mem, m.size, lv, sprites);
+   unmap_file(&m);
+
+   return ret;
+}
+
+
+/* Compare everything a compiled level stores */
+static bool same_level(struct level_t *a, struct level_t *b)
+{
+   int i;
+   struct prop_t pa, pb;
+
+   for (i = 0; i < NUM_LAYERS; i++) {
+      if (strcmp(a->lpng[i], b->lpng[i]) ||
+          a->layers[i].x != b->layers[i].x ||
+          a->layers[i].y != b->layers[i].y) {
+         WARN("Layer %d differs", i);
+         return false;
+      }
+   }
+   for (i = 0; i < NUM_TARGETS; i++) {
+      /* Compare props byte by byte, except the sprite pointer */
+      memcpy(&pa, &a->props[i], sizeof(struct prop_t));
+      memcpy(&pb, &b->props[i], sizeof(struct prop_t));
+      pa.spr = NULL;
+      pb.spr = NULL;
+      if (strcmp(a->tpng[i], b->tpng[i]) ||
+          memcmp(&pa, &pb, sizeof(struct prop_t))) {
+         WARN("Target %d differs", i);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+#ifdef __linux__
+/* Watch directory of file unless it is watched already */
+static void watch_add(const char *file)
+{
+   char dir[LEVEL_PNG_LEN];
+   const char *slash = strrchr(file, '/');
+   int i, wd;
+
+   if (slash) {
+      snprintf(dir, sizeof(dir), "%.*s", (int)(slash - file), file);
+   } else {
+      strcpy(dir, ".");
+   }
+   for (i = 0; i < watch_dirs; i++) {
+      if (strcmp(dir, watch_dir[i]) == 0) {
+         return;
+      }
+   }
+   if (watch_dirs == WATCH_DIRS) {
+      WARN("Too many directories, %s not watched", file);
+      return;
+   }
+
+   /* Editors either rewrite files or rename new files over them */
+   wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+   if (wd < 0) {
+      perror(dir);
+      return;
+   }
+   watch_wd[watch_dirs] = wd;
+   strcpy(watch_dir[watch_dirs], dir);
+   watch_dirs++;
+}
+#endif
+
+
+/* Watch current level file and its pngs */
+static void watch_level(void)
+{
+#ifdef __linux__
+   int i;
+
+   if (watch_fd < 0) {
+      return;
+   }
+
+   for (i = 0; i < watch_dirs; i++) {
+      inotify_rm_watch(watch_fd, watch_wd[i]);
+   }
+   watch_dirs = 0;
+
+   if (strchr(current_name, '#')) {
+      WARN("Levels in packs can't be hot reloaded");
+      return;
+   }
+
+   watch_add(current_name);
+   for (i = 0; i < NUM_LAYERS; i++) {
+      watch_add(current->lpng[i]);
+   }
+   for (i = 0; i < NUM_TARGETS; i++) {
+      watch_add(current->tpng[i]);
+   }
+#endif
+}
+
+
+/* Replace sprite with filename, keep the old one if loading fails */
+static bool reload_sprite(struct sprite_t *sprp, const char *filename)
+{
+   struct sprite_t spr;
+
+   memset(&spr, 0, sizeof(spr));
+   /* From the file, not the copy built in with EMBED=1 */
+   if (!sprite_reload_png(&spr, filename, true)) {
+      WARN("sprite_reload_png failed for %s", filename);
+      return false;
+   }
+   sprite_free(sprp);
+   *sprp = spr;
+
+   return true;
+}
+
+
+/* Parse current level file again and apply the differences to the
+ * running level. Only changed pngs are decoded again. State of living
+ * targets, score and time are left alone, unless a count changed:
+ * then all targets start over dead.
+ */
+static bool reload_level(bool *lchanged, bool *tchanged)
+{
+   static struct level_t fresh;
+   struct prop_t *kind;
+   struct prop_t prop;
+   bool recount = false;
+   int i, j;
+   int images = 0;
+   int props = 0;
+
+   if (strchr(current_name, '#')) {
+      /* Would share the pack mapping with the preloader */
+      return false;
+   }
+
+   init_level(&fresh);
+   /* Parse only, geometry is calculated from the new png headers */
+   if (!read_level(current_name, &fresh, false)) {
+      WARN("Reloading %s failed, keeping old level", current_name);
+      return false;
+   }
+
+   for (i = 0; i < NUM_LAYERS; i++) {
+      if (lchanged[i] || strcmp(fresh.lpng[i], current->lpng[i])) {
+         if (reload_sprite(current->layers[i].spr, fresh.lpng[i])) {
+            strcpy(current->lpng[i], fresh.lpng[i]);
+            images++;
+         }
+      }
+      current->layers[i].x = fresh.layers[i].x;
+      current->layers[i].y = fresh.layers[i].y;
+   }
+
+   for (i = 0; i < NUM_TARGETS; i++) {
+      kind = &current->props[i];
+      if (tchanged[i] || strcmp(fresh.tpng[i], current->tpng[i])) {
+         if (reload_sprite(kind->spr, fresh.tpng[i])) {
+            strcpy(current->tpng[i], fresh.tpng[i]);
+            images++;
+         }
+      }
+      memcpy(&prop, &fresh.props[i], sizeof(struct prop_t));
+      prop.spr = kind->spr;
+      if (memcmp(&prop, kind, sizeof(struct prop_t))) {
+         if (prop.count != kind->count) {
+            recount = true;
+         }
+         memcpy(kind, &prop, sizeof(struct prop_t));
+         for (j = current->first[i]; j < current->first[i + 1]; j++) {
+            memcpy(&current->targets[j].prop, &prop, sizeof(struct prop_t));
+            current->targets[j].prop.spr = &current->targets[j].spr;
+         }
+         props++;
+      }
+   }
+
+   level_free(&fresh);
+
+   if (recount) {
+      free_targets(current);
+      if (!make_targets(current)) {
+         return false;
+      }
+   }
+   if (recount || images) {
+      share_sprites(current);
+   }
+
+   place_layers(current);
+   /* New pngs may be in other directories */
+   watch_level();
+
+   /* stdout is parsed in -b and -B runs, failures are WARNed above */
+   DBG("Reloaded %s: %d changed targets, %d new images", current_name, props, images);
+
+   return true;
+}
+
+
+/* Preloader thread */
+static int preload_main(void *data UNUSED)
+{
+   /* Parses and decodes into the staging slot only. Conversion to
+    * the display format waits for load_level() on the main thread.
+    */
+   preload_ok = read_level(preload_name, staging, true);
+
+   return 0;
+}
+
+
+/* Wait for preloader thread to finish */
+static void preload_wait(void)
+{
+   if (preload_thread) {
+      SDL_WaitThread(preload_thread, NULL);
+      preload_thread = NULL;
    }
+}
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+/* Free resources allocated by load_level */
+void free_level(void)
+{
+   level_free(current);
+}
+
+
+/* Load filename into current level. Swap in the staging slot
+ * instead if it already holds filename.
+ */
+struct level_t *load_level(const char *filename)
+{
+   struct level_t *lv;
+
+   init_slots();
+
+   /* Blocks only if the preloader isn't finished yet */
+   preload_wait();
+   if (preload_ok && strcmp(filename, preload_name) == 0) {
+      DBG("Using preloaded %s", filename);
+      level_free(current);
+      lv = staging;
+      staging = current;
+      current = lv;
+      preload_ok = false;
+   } else {
+      level_preload_cancel();
+      current->max_bytes = 0;
+      if (!read_level(filename, current, true)) {
+         return NULL;
+      }
+   }
+   if (!display_sprites(current)) {
+      level_free(current);
+      return NULL;
+   }
+   snprintf(current_name, sizeof(current_name), "%s", filename);
+   watch_level();
 
    /* Draw background */
-   sprite_blit(*(layers[NUM_LAYERS - 1].spr));
+   sprite_blit(*(current->layers[NUM_LAYERS - 1].spr));
    video_flip();
 
+   return current;
+}
+
+
+/* Free resources allocated by parse_level */
+void level_free(struct level_t *lv)
+{
+   int i;
+
+   free_targets(lv);
+   for (i = 0; i < NUM_TARGETS; i++) {
+      if (lv->props[i].spr->spr) {
+         sprite_free(lv->props[i].spr);
+      }
+   }
+   if (lv->scorespr.spr) {
+      sprite_free(&lv->scorespr);
+   }
+
+   for (i = 0; i < NUM_LAYERS; i++) {
+      if (lv->layers[i].spr->spr) {
+         sprite_free(lv->layers[i].spr);
+      }
+      lv->layers[i].x = -1;
+      lv->layers[i].y = -1;
+      lv->lpng[i][0] = '\x0';
+   }
+   for (i = 0; i < NUM_TARGETS; i++) {
+      lv->tpng[i][0] = '\x0';
+   }
+}
+
+
+bool level_read(struct level_t *lv, const char *filename)
+{
+   init_level(lv);
+   if (!read_level(filename, lv, true)) {
+      return false;
+   }
+   if (!display_sprites(lv)) {
+      level_free(lv);
+      return false;
+   }
+
+   return true;
+}
+
+
+bool level_preload_start(const char *filename)
+{
+   init_slots();
+
+   if (preload_thread || preload_ok) {
+      WARN("%s already preloaded", preload_name);
+      return false;
+   }
+
+   snprintf(preload_name, sizeof(preload_name), "%s", filename);
+   staging->cancel = false;
+   staging->max_bytes = preload_max_bytes;
+
+   preload_thread = SDL_CreateThread(preload_main, NULL);
+   if (unlikely(!preload_thread)) {
+      WARN("SDL_CreateThread -> %s", SDL_GetError());
+      return false;
+   }
+
+   return true;
+}
+
+
+void level_preload_cancel(void)
+{
+   staging->cancel = true;
+   preload_wait();
+   if (preload_ok) {
+      level_free(staging);
+      preload_ok = false;
+   }
+   staging->cancel = false;
+}
+
+
+void level_preload_limit(size_t max_bytes)
+{
+   preload_max_bytes = max_bytes;
+}
+
+
+bool compile_level(const char *src, const char *dst)
+{
+   static struct level_t text, bin;
+   struct level_header_t hdr;
+   struct level_layer_rec_t lrec;
+   struct level_target_rec_t trec;
+   FILE *fp;
+   int i;
+   bool ret = false;
+
+   init_level(&text);
+   init_level(&bin);
+
+   if (!read_level(src, &text, false)) {
+      goto out;
+   }
+
+   if (!(fp = fopen(dst, "wb"))) {
+      perror(dst);
+      goto out2;
+   }
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, LEVEL_MAGIC, 4);
+   hdr.version = LEVEL_VERSION;
+   hdr.prop_size = sizeof(struct prop_t);
+   hdr.num_layers = NUM_LAYERS;
+   hdr.num_targets = NUM_TARGETS;
+   fwrite(&hdr, sizeof(hdr), 1, fp);
+
+   for (i = 0; i < NUM_LAYERS; i++) {
+      memset(&lrec, 0, sizeof(lrec));
+      strcpy(lrec.png, text.lpng[i]);
+      lrec.x = text.layers[i].x;
+      lrec.y = text.layers[i].y;
+      fwrite(&lrec, sizeof(lrec), 1, fp);
+   }
+   for (i = 0; i < NUM_TARGETS; i++) {
+      memset(&trec, 0, sizeof(trec));
+      strcpy(trec.png, text.tpng[i]);
+      memcpy(&trec.prop, &text.props[i], sizeof(struct prop_t));
+      trec.prop.spr = NULL;
+      fwrite(&trec, sizeof(trec), 1, fp);
+   }
+
+   if (fclose(fp) != 0) {
+      perror(dst);
+      goto out3;
+   }
+
+   /* Round trip, read it back and compare */
+   if (!read_level(dst, &bin, false)) {
+      goto out3;
+   }
+   if (!same_level(&text, &bin)) {
+      WARN("%s doesn't match %s", dst, src);
+      goto out3;
+   }
+
    ret = true;
 
 out3:
 
-#ifdef _WIN32
-   UnmapViewOfFile(mem);
-   CloseHandle(fhmap);
-#else
-   munmap(mem, statbuf.st_size);
-#endif
+   if (!ret) {
+      unlink(dst);
+   }
+
+out2:
+
+   level_free(&text);
+   level_free(&bin);
+
+out:
+
+   return ret;
+}
+
+
+bool pack_levels(const char *dst, int n, char *src[])
+{
+   static struct level_t text, packed;
+   struct pack_header_t hdr;
+   struct pack_entry_t *entries;
+   char entry[LEVEL_PNG_LEN + 16];
+   struct mapping_t m;
+   Bytef *cbuf;
+   uLongf clen;
+   FILE *fp;
+   long offset;
+   int i;
+   bool ret = false;
+
+   entries = (struct pack_entry_t *)calloc(n, sizeof(struct pack_entry_t));
+   if (!entries) {
+      WARN("calloc failed");
+      goto out;
+   }
+
+   if (!(fp = fopen(dst, "wb"))) {
+      perror(dst);
+      goto out2;
+   }
+
+   /* Header and placeholder entries, the entries are written
+    * again when the offsets are known.
+    */
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, PACK_MAGIC, 4);
+   hdr.version = PACK_VERSION;
+   hdr.num_levels = n;
+   fwrite(&hdr, sizeof(hdr), 1, fp);
+   fwrite(entries, sizeof(struct pack_entry_t), n, fp);
+   offset = sizeof(hdr) + n * sizeof(struct pack_entry_t);
+
+   for (i = 0; i < n; i++) {
+      if (!map_file(src[i], &m)) {
+         goto out3;
+      }
+      clen = compressBound(m.size);
+      cbuf = (Bytef *)malloc(clen);
+      if (!cbuf) {
+         WARN("malloc failed for %s", src[i]);
+         unmap_file(&m);
+         goto out3;
+      }
+      if (compress2(cbuf, &clen, (Bytef *)m.mem, m.size, Z_BEST_COMPRESSION) != Z_OK) {
+         WARN("compress2 failed for %s", src[i]);
+         free(cbuf);
+         unmap_file(&m);
+         goto out3;
+      }
+      entries[i].offset = offset;
+      entries[i].clen = clen;
+      entries[i].ulen = m.size;
+      fwrite(cbuf, 1, clen, fp);
+      offset += clen;
+      free(cbuf);
+      unmap_file(&m);
+   }
+
+   fseek(fp, sizeof(hdr), SEEK_SET);
+   fwrite(entries, sizeof(struct pack_entry_t), n, fp);
+
+   if (fclose(fp) != 0) {
+      perror(dst);
+      goto out4;
+   }
+   fp = NULL;
+
+   /* Read every level back from the pack and compare */
+   for (i = 0; i < n; i++) {
+      init_level(&text);
+      init_level(&packed);
+      snprintf(entry, sizeof(entry), "%s#%d", dst, i + 1);
+      if (!read_level(src[i], &text, false)) {
+         goto out4;
+      }
+      if (!read_level(entry, &packed, false) || !same_level(&text, &packed)) {
+         WARN("%s doesn't match %s", entry, src[i]);
+         level_free(&text);
+         level_free(&packed);
+         goto out4;
+      }
+      level_free(&text);
+      level_free(&packed);
+   }
+
+   ret = true;
+
+out3:
+
+   if (fp) {
+      fclose(fp);
+   }
+
+out4:
+
+   level_pack_close();
+   if (!ret) {
+      unlink(dst);
+   }
 
 out2:
 
-   close(fd);
+   free(entries);
 
 out:
 
    return ret;
 }
+
+
+void level_pack_close(void)
+{
+   unmap_file(&pack);
+}
+
+
+bool level_watch_start(void)
+{
+#ifdef __linux__
+   watch_fd = inotify_init1(IN_NONBLOCK);
+   if (watch_fd < 0) {
+      perror("inotify_init1");
+      return false;
+   }
+   if (current_name[0]) {
+      watch_level();
+   }
+   return true;
+#else
+   WARN("Hot reload needs inotify");
+   return false;
+#endif
+}
+
+
+bool level_watch_poll(void)
+{
+#ifdef __linux__
+   char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+   char path[2 * LEVEL_PNG_LEN];
+   struct inotify_event *ev;
+   bool lchanged[NUM_LAYERS];
+   bool tchanged[NUM_TARGETS];
+   bool changed = false;
+   ssize_t len;
+   char *p;
+   int i;
+
+   if (likely(watch_fd < 0)) {
+      return false;
+   }
+
+   memset(lchanged, 0, sizeof(lchanged));
+   memset(tchanged, 0, sizeof(tchanged));
+
+   /* Collect everything that happened since last frame */
+   while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+      for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+         ev = (struct inotify_event *)p;
+         if (!ev->len) {
+            continue;
+         }
+         for (i = 0; i < watch_dirs && watch_wd[i] != ev->wd; i++);
+         if (i == watch_dirs) {
+            continue;
+         }
+         if (strcmp(watch_dir[i], ".") == 0) {
+            snprintf(path, sizeof(path), "%s", ev->name);
+         } else {
+            snprintf(path, sizeof(path), "%s/%s", watch_dir[i], ev->name);
+         }
+
+         if (strcmp(path, current_name) == 0) {
+            changed = true;
+         }
+         for (i = 0; i < NUM_LAYERS; i++) {
+            if (strcmp(path, current->lpng[i]) == 0) {
+               lchanged[i] = changed = true;
+            }
+         }
+         for (i = 0; i < NUM_TARGETS; i++) {
+            if (strcmp(path, current->tpng[i]) == 0) {
+               tchanged[i] = changed = true;
+            }
+         }
+      }
+   }
+
+   if (likely(!changed)) {
+      return false;
+   }
+
+   return reload_level(lchanged, tchanged);
+#else
+   return false;
+#endif
+}
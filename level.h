@@ -75,6 +75,9 @@ struct prop_t {
 
    /* Number of frames animal lives each life */
    int max_age;
+   /* Instances that can live at the same time, 0..LEVEL_MAX_COUNT.
+    * They share the sprite. */
+   int count;
 
    /* Distance from upper right corner to center of target */
    int targ_x, targ_y;
@@ -139,13 +142,22 @@ enum goldstar_t {
 };
 
 
+/* Kinds of targets in a level */
 #define NUM_TARGETS 7
+/* Most instances of one kind, see struct prop_t count */
+#define LEVEL_MAX_COUNT 10000
 
 struct target_t {
-   /* Properties */
+   /* Properties, a copy of those of its kind */
    struct prop_t prop;
-
-   /* Sprite showing current score */
+   /* Index of the kind, 0..NUM_TARGETS - 1 */
+   int kind;
+   /* The sprite of the kind, with a rotation of its own. prop.spr
+    * points here. */
+   struct sprite_t spr;
+
+   /* Sprite showing current score, copied from the level's
+    * scorespr the first time the target is hit */
    struct sprite_t scorespr;
    int scoreangle;
    /* Goldstars behind score? */
@@ -155,7 +167,7 @@ struct target_t {
 
    /* Dead/Living/Hit */
    enum target_state state;
-   /* Init to 0 when spawning target. Increase each frame. */
+   /* Init to 0 when spawning target. Increase each simulation step. */
    int age;
    /* Age when target was hit */
    int hit_age;
@@ -177,6 +189,15 @@ struct target_t {
    int flag_tx, flag_ty;
    /* Zoom */
    float zoom;
+   /* Translation, rotation and zoom of the previous simulation
+    * step, drawing interpolates from these.
+    */
+   float ptx, pty;
+   float ptfi;
+   float pzoom;
+   /* Rotation and zoom as last drawn */
+   float rtfi;
+   float rzoom;
    /* Have flag? */
    bool white;
    bool yellow;
@@ -207,18 +228,121 @@ struct layer_t {
 };
 
 
+/* Max length of png filenames in level files */
+#define LEVEL_PNG_LEN 64
+
+/* Everything a level file loads. There are two of these, the level
+ * being played and a staging slot the preloader fills in the background.
+ */
+struct level_t {
+   struct sprite_t tspr[NUM_TARGETS];
+   /* Properties of each kind of target, as in the level file */
+   struct prop_t props[NUM_TARGETS];
+   /* count instances of each kind, in kind order. Kind k is
+    * targets[first[k]] up to but not including targets[first[k + 1]].
+    * Allocated when the sprites are loaded.
+    */
+   struct target_t *targets;
+   int num_targets;
+   int first[NUM_TARGETS + 1];
+   /* Template for the scorespr of the targets */
+   struct sprite_t scorespr;
+   struct sprite_t lspr[NUM_LAYERS];
+   struct layer_t layers[NUM_LAYERS];
+   int bg_x;
+   int bg_y;
+   /* Png files of layers and targets */
+   char lpng[NUM_LAYERS][LEVEL_PNG_LEN];
+   char tpng[NUM_TARGETS][LEVEL_PNG_LEN];
+   /* Decoded image memory used by the level */
+   size_t bytes;
+   /* Fail loading if bytes grows above this, 0 = no limit */
+   size_t max_bytes;
+   /* Set to abort parsing */
+   volatile bool cancel;
+};
+
+
 /* ----------------------------------------------
  * Exported variables and functions from level.c
  * ----------------------------------------------
  */
 
-extern int bg_x;
-extern int bg_y;
-extern struct target_t targets[];
-extern struct layer_t layers[];
-bool load_level(const char *filename);
+/**
+ * Load filename as the level being played, swapping in a preloaded
+ * copy if there is one, and draw its background.
+ * @return the level, NULL on failure or if there are no more levels
+ */
+struct level_t *load_level(const char *filename);
+
+/**
+ * Free the level being played.
+ */
 void free_level(void);
 
+/**
+ * Load filename into a level of the caller's own, for games that
+ * aren't played in the window. Nothing is preloaded, watched or
+ * drawn. Free with level_free(), on failure it is already freed.
+ * @return true if loaded
+ */
+bool level_read(struct level_t *lv, const char *filename);
+void level_free(struct level_t *lv);
+
+/**
+ * Start loading filename into the staging slot in a background thread.
+ * Its pngs are decoded to software surfaces there. The next
+ * load_level() of the same file swaps it in without parsing and
+ * converts them to the display format.
+ * @return true if the thread was started
+ */
+bool level_preload_start(const char *filename);
+
+/**
+ * Abort a running preload and free the staging slot.
+ */
+void level_preload_cancel(void);
+
+/**
+ * Limit decoded image memory of preloaded levels, 0 = no limit.
+ */
+void level_preload_limit(size_t max_bytes);
+
+/**
+ * Compile text level src into the binary level format at dst.
+ * The binary is read back and checked against the text.
+ * load_level() accepts both formats.
+ * @return true if dst was written and verified
+ */
+bool compile_level(const char *src, const char *dst);
+
+/**
+ * Write the n level files in src (text or compiled) to a level pack
+ * at dst, src[0] being level 1. Load pack levels with
+ * load_level("<pack>#<level number>"). Every level is read back from
+ * the pack and checked.
+ * @return true if dst was written and verified
+ */
+bool pack_levels(const char *dst, int n, char *src[]);
+
+/**
+ * Unmap the level pack used by the last load_level().
+ */
+void level_pack_close(void);
+
+/**
+ * Watch the current level file and its pngs for changes (Linux only).
+ * @return true if watching
+ */
+bool level_watch_start(void);
+
+/**
+ * Apply changes to watched files to the running level. Call between
+ * frames. Score, time and living targets are kept.
+ * @return true if the level was reloaded
+ */
+bool level_watch_poll(void);
+
 
 /**
  * GNU Emacs settings: K&R with 3 spaces indent.
@@ -0,0 +1,458 @@
+/**
+ * @file profile.c
+ * @brief Frame phase timing histograms.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "carnival.h"
+#include "profile.h"
+
+
+/* ----------------------------------------------
+ * Local variables
+ * ----------------------------------------------
+ */
+
+/* Log-linear histogram of times in us. Each power of two is split
+ * in HIST_SUB buckets, so a bucket is at most 1/HIST_SUB wide
+ * relative its value. Covers more than a minute.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB * 24)
+
+/* Only the main loop writes, counters need no locking */
+struct histogram_t {
+   unsigned int count[HIST_BUCKETS];
+   unsigned int samples;
+   long long max;
+   double sum;
+};
+
+static struct histogram_t hist[NUM_PHASES];
+/* Click to photon latency of the current level */
+static struct histogram_t latency;
+static long long last[NUM_PHASES];
+
+/* A frame ends when its sleep phase does */
+static long long frame_start = 0;
+static long long frame_times[PROFILE_FRAMES];
+static unsigned int frame_n = 0;
+
+__thread unsigned int counters[NUM_COUNTERS];
+static unsigned int counters_last[NUM_COUNTERS];
+static unsigned long long counters_level[NUM_COUNTERS];
+static unsigned int level_frames = 0;
+
+/* Inputs not yet shown on screen */
+#define MAX_PENDING_INPUTS 64
+
+struct input_t {
+   long long arrived;
+   /* Frame that handled the input */
+   unsigned int frame;
+};
+
+static struct input_t pending[MAX_PENDING_INPUTS];
+static int num_pending = 0;
+
+static const char *counter_names[NUM_COUNTERS] = {
+   "blits",
+   "pixels read",
+   "pixels written",
+   "rotozoom rgba smooth",
+   "rotozoom rgba",
+   "rotozoom 8bit",
+   "zoom rgba smooth",
+   "zoom rgba",
+   "zoom 8bit",
+   "surfaces created",
+   "surfaces freed",
+   "zoom mallocs"
+};
+
+static const char *phase_names[NUM_PHASES] = {
+   "handle_events",
+   "move_targets",
+   "draw_layers",
+   "video_flip",
+   "sleep"
+};
+
+
+/* Trace events, one ring buffer per thread. When full the oldest
+ * events are overwritten.
+ */
+#define TRACE_RING_SIZE (1 << 16)
+
+struct trace_event_t {
+   const char *name;
+   long long start;
+   long long dur;
+};
+
+struct trace_ring_t {
+   struct trace_ring_t *next;
+   int tid;
+   unsigned int n;
+   struct trace_event_t ev[TRACE_RING_SIZE];
+};
+
+bool trace_enabled = false;
+static const char *trace_file;
+/* All rings, new ones are pushed without locking */
+static struct trace_ring_t *rings = NULL;
+static int trace_threads = 0;
+static __thread struct trace_ring_t *ring = NULL;
+
+
+/* ----------------------------------------------
+ * Local functions
+ * ----------------------------------------------
+ */
+
+static int hist_bucket(unsigned int us)
+{
+   int e = 0;
+
+   while (us >= 2 * HIST_SUB) {
+      us >>= 1;
+      e++;
+   }
+   if (unlikely(e >= HIST_BUCKETS / HIST_SUB - 1)) {
+      return HIST_BUCKETS - 1;
+   }
+   return e * HIST_SUB + us;
+}
+
+
+/* Middle of bucket b in ms */
+static double hist_value(int b)
+{
+   int e;
+
+   if (b < 2 * HIST_SUB) {
+      return (b + 0.5) / 1000.0;
+   }
+   e = b / HIST_SUB - 1;
+   return (((b % HIST_SUB + HIST_SUB) << e) + (1 << e) / 2.0) / 1000.0;
+}
+
+
+static void hist_add(struct histogram_t *h, long long t)
+{
+   h->count[hist_bucket((unsigned int)(t / 1000))]++;
+   h->samples++;
+   h->sum += t;
+   if (t > h->max) {
+      h->max = t;
+   }
+}
+
+
+/* Value below which a share p (0..1) of the samples are, in ms */
+static double hist_percentile(struct histogram_t *h, double p)
+{
+   unsigned int n = 0;
+   unsigned int want = (unsigned int)(p * h->samples + 0.5);
+   int b;
+
+   if (want < 1) {
+      want = 1;
+   }
+   for (b = 0; b < HIST_BUCKETS; b++) {
+      n += h->count[b];
+      if (n >= want) {
+         break;
+      }
+   }
+   if (b == HIST_BUCKETS) {
+      b--;
+   }
+   /* Never report more than the largest sample */
+   if (hist_value(b) > h->max / 1000000.0) {
+      return h->max / 1000000.0;
+   }
+   return hist_value(b);
+}
+
+
+static void hist_print(const char *name, struct histogram_t *h)
+{
+   printf("%-14s %8.3f %8.3f %8.3f %8.3f %8.3f\n", name,
+          h->sum / h->samples / 1000000.0,
+          hist_percentile(h, 0.50), hist_percentile(h, 0.90),
+          hist_percentile(h, 0.99), h->max / 1000000.0);
+}
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+long long profile_time(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+long long profile_phase(enum phase_t phase, long long start)
+{
+   long long now = profile_time();
+   long long t = now - start;
+   struct histogram_t *h = &hist[phase];
+   int i;
+
+   hist_add(h, t);
+   if (trace_enabled) {
+      trace_add(phase_names[phase], start);
+   }
+   last[phase] = t;
+
+   if (phase == Phase_sleep) {
+      if (likely(frame_start)) {
+         frame_times[frame_n++ % PROFILE_FRAMES] = now - frame_start;
+      }
+      frame_start = now;
+      for (i = 0; i < NUM_COUNTERS; i++) {
+         counters_level[i] += counters[i];
+      }
+      level_frames++;
+      memcpy(counters_last, counters, sizeof(counters));
+      memset(counters, 0, sizeof(counters));
+   }
+
+   return now;
+}
+
+
+void profile_input(long long arrived, unsigned int frame)
+{
+   if (unlikely(num_pending == MAX_PENDING_INPUTS)) {
+      return;
+   }
+   pending[num_pending].arrived = arrived;
+   pending[num_pending].frame = frame;
+   num_pending++;
+}
+
+
+void profile_photon(unsigned int frame)
+{
+   long long now;
+   int i, n = 0;
+
+   if (likely(num_pending == 0)) {
+      return;
+   }
+   now = profile_time();
+   for (i = 0; i < num_pending; i++) {
+      if (pending[i].frame <= frame) {
+         hist_add(&latency, now - pending[i].arrived);
+      } else {
+         pending[n++] = pending[i];
+      }
+   }
+   num_pending = n;
+}
+
+
+long long profile_last(enum phase_t phase)
+{
+   return last[phase];
+}
+
+
+long long profile_frame_time(int ago)
+{
+   if (ago >= PROFILE_FRAMES || (unsigned int)ago >= frame_n) {
+      return 0;
+   }
+   return frame_times[(frame_n - 1 - ago) % PROFILE_FRAMES];
+}
+
+
+unsigned int profile_counter(enum counter_t c)
+{
+   return counters_last[c];
+}
+
+
+void profile_print_level(int level)
+{
+   int i;
+
+   if (level_frames == 0) {
+      return;
+   }
+   printf("Level %d, %u frames:\n", level, level_frames);
+   printf("  %-22s %14s %12s\n", "Counter", "total", "per frame");
+   for (i = 0; i < NUM_COUNTERS; i++) {
+      printf("  %-22s %14llu %12.1f\n", counter_names[i], counters_level[i],
+             (double)counters_level[i] / level_frames);
+   }
+   memset(counters_level, 0, sizeof(counters_level));
+   level_frames = 0;
+
+   if (latency.samples > 0) {
+      printf("  Click to photon, %u clicks:\n", latency.samples);
+      printf("  %-14s %8s %8s %8s %8s %8s  (ms)\n", "", "mean", "p50", "p90", "p99", "max");
+      printf("  ");
+      hist_print("latency", &latency);
+      memset(&latency, 0, sizeof(latency));
+   }
+}
+
+
+void profile_print(void)
+{
+   struct histogram_t *h;
+   int i;
+
+   printf("%-14s %8s %8s %8s %8s %8s  (ms)\n", "Phase", "mean", "p50", "p90", "p99", "max");
+   for (i = 0; i < NUM_PHASES; i++) {
+      h = &hist[i];
+      if (h->samples == 0) {
+         continue;
+      }
+      hist_print(phase_names[i], h);
+   }
+}
+
+
+/* How many times per second each phase could run on its own */
+void profile_print_throughput(void)
+{
+   struct histogram_t *h;
+   int i;
+
+   printf("%-14s %10s %12s %12s\n", "Phase", "runs", "total (ms)", "per second");
+   for (i = 0; i < NUM_PHASES; i++) {
+      h = &hist[i];
+      if (h->samples == 0 || h->sum <= 0) {
+         continue;
+      }
+      printf("%-14s %10u %12.1f %12.0f\n", phase_names[i], h->samples,
+             h->sum / 1000000.0, h->samples * 1000000000.0 / h->sum);
+   }
+}
+
+
+void trace_start(const char *filename)
+{
+   trace_file = filename;
+   trace_enabled = true;
+}
+
+
+void trace_add(const char *name, long long start)
+{
+   struct trace_ring_t *r = ring;
+   struct trace_event_t *e;
+
+   if (unlikely(!r)) {
+      r = (struct trace_ring_t *)calloc(1, sizeof(struct trace_ring_t));
+      if (!r) {
+         return;
+      }
+      r->tid = __sync_add_and_fetch(&trace_threads, 1);
+      do {
+         r->next = rings;
+      } while (!__sync_bool_compare_and_swap(&rings, r->next, r));
+      ring = r;
+   }
+   e = &r->ev[r->n++ & (TRACE_RING_SIZE - 1)];
+   e->name = name;
+   e->start = start;
+   e->dur = profile_time() - start;
+}
+
+
+void trace_dump(void)
+{
+   FILE *fp;
+   struct trace_ring_t *r;
+   struct trace_event_t *e;
+   unsigned int i, first;
+   int n = 0;
+
+   if (!trace_enabled) {
+      return;
+   }
+   trace_enabled = false;
+
+   fp = fopen(trace_file, "w");
+   if (!fp) {
+      WARN("Could not open %s", trace_file);
+      return;
+   }
+   fprintf(fp, "{\"traceEvents\":[\n");
+   for (r = rings; r; r = r->next) {
+      first = r->n > TRACE_RING_SIZE ? r->n - TRACE_RING_SIZE : 0;
+      for (i = first; i < r->n; i++) {
+         e = &r->ev[i & (TRACE_RING_SIZE - 1)];
+         fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}\n",
+                 n++ ? "," : "", e->name, e->start / 1000.0, e->dur / 1000.0, r->tid);
+      }
+   }
+   fprintf(fp, "],\"displayTimeUnit\":\"ns\"}\n");
+   fclose(fp);
+   printf("Wrote %d trace events to %s\n", n, trace_file);
+
+   while (rings) {
+      r = rings->next;
+      free(rings);
+      rings = r;
+   }
+}
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,206 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+/**
+ * @file profile.h
+ * @brief Frame phase timing.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdbool.h>
+
+
+/* ----------------------------------------------
+ * Exported types
+ * ----------------------------------------------
+ */
+
+/* Phases of the main loop */
+enum phase_t {
+   Phase_events,
+   Phase_move,
+   Phase_draw,
+   Phase_flip,
+   Phase_sleep,
+   NUM_PHASES
+};
+
+/* Work counted per frame */
+enum counter_t {
+   Count_blits,
+   /* Pixels of blits and rotozooms */
+   Count_pixels_read,
+   Count_pixels_written,
+   /* rotozoomSurfaceXY() by path */
+   Count_rz_rgba_smooth,
+   Count_rz_rgba,
+   Count_rz_8bit,
+   Count_zoom_rgba_smooth,
+   Count_zoom_rgba,
+   Count_zoom_8bit,
+   Count_surfaces_created,
+   Count_surfaces_freed,
+   /* malloc() calls in the zoom kernels */
+   Count_zoom_mallocs,
+   NUM_COUNTERS
+};
+
+/* Open trace event, closed when it goes out of scope */
+struct trace_scope_t {
+   const char *name;
+   long long start;
+};
+
+
+/* ----------------------------------------------
+ * Exported variables and macros
+ * ----------------------------------------------
+ */
+extern bool trace_enabled;
+
+/* Frame times kept for profile_frame_time() */
+#define PROFILE_FRAMES 128
+
+/* Counters of the frame being made. Per thread, so work done by
+ * background threads (level preloading) is not counted.
+ */
+extern __thread unsigned int counters[NUM_COUNTERS];
+#define COUNT(c, n) { counters[c] += (n); }
+
+/* Trace the rest of the enclosing block as event name. Costs a
+ * test of trace_enabled when tracing is off.
+ */
+#define TRACE_SCOPE(name)                                               \
+   struct trace_scope_t __trace_scope __attribute__ ((cleanup(trace_end))) = \
+   { (name), trace_enabled ? profile_time() : 0 }
+
+
+/* ----------------------------------------------
+ * Exported functions from profile.c
+ * ----------------------------------------------
+ */
+
+/**
+ * Monotonic time in ns.
+ */
+long long profile_time(void);
+
+/**
+ * Add the time from start until now to the histogram of phase.
+ * @return now, the start of the next phase
+ */
+long long profile_phase(enum phase_t phase, long long start);
+
+/**
+ * Remember that an input that arrived at time arrived (ns) was
+ * handled in frame.
+ */
+void profile_input(long long arrived, unsigned int frame);
+
+/**
+ * Called right after frame has been flipped to the screen. Adds
+ * the latency of the inputs handled up to frame.
+ */
+void profile_photon(unsigned int frame);
+
+/**
+ * @return time of phase in the last frame, ns
+ */
+long long profile_last(enum phase_t phase);
+
+/**
+ * @return length of the frame ago frames back (0 = last), ns
+ */
+long long profile_frame_time(int ago);
+
+/**
+ * @return counter c of the last frame
+ */
+unsigned int profile_counter(enum counter_t c);
+
+/**
+ * Print the counters summed over all frames since the last call,
+ * and per frame, and click to photon latency percentiles, then
+ * start over. Called when a level ends.
+ */
+void profile_print_level(int level);
+
+/**
+ * Print p50/p90/p99/max of each phase.
+ */
+void profile_print(void);
+
+/**
+ * Print how many times each phase ran, its total time and how many
+ * runs per second that is. Used by the headless benchmark.
+ */
+void profile_print_throughput(void);
+
+/**
+ * Start recording trace events, written to filename by trace_dump().
+ */
+void trace_start(const char *filename);
+
+/**
+ * Record event name from start until now in the ring buffer of
+ * the calling thread.
+ */
+void trace_add(const char *name, long long start);
+
+/**
+ * Write recorded events as Chrome trace event JSON, for
+ * chrome://tracing or Perfetto. Call when other threads are done.
+ */
+void trace_dump(void);
+
+static inline void trace_end(struct trace_scope_t *s)
+{
+   if (s->start) {
+      trace_add(s->name, s->start);
+   }
+}
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
+
+#endif  /* __PROFILE_H */
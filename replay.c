@@ -0,0 +1,431 @@
+/**
+ * @file replay.c
+ * @brief Record and play back the input of a game.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "carnival.h"
+#include "replay.h"
+
+
+/* Replay file:
+ *
+ * "CRPL", version byte, varint seed
+ * records until Replay_end
+ *
+ * A record is a type byte, the varint number of ticks since the
+ * previous record and then per type:
+ *
+ * Replay_level    varint length, name
+ * Replay_click    varint offset (ns), zigzag varint x and y relative
+ *                 to the previous click
+ * Replay_key      varint key
+ * Replay_quality  varint tier
+ * Replay_end      zigzag varint total score, varint hits, varint checksum
+ *
+ * Varints are 7 bits per byte, low bits first, high bit set on all
+ * but the last byte.
+ */
+#define REPLAY_MAGIC "CRPL"
+#define REPLAY_VERSION 1
+
+/* FNV-1a */
+#define CHECKSUM_START 2166136261U
+#define CHECKSUM_PRIME 16777619U
+
+
+/* ----------------------------------------------
+ * Local variables
+ * ----------------------------------------------
+ */
+
+/* Recording */
+static FILE *rec_fp = NULL;
+
+/* Playback, the whole file is read at start */
+static unsigned char *play_buf = NULL;
+static size_t play_size = 0;
+static size_t play_pos = 0;
+static struct replay_event_t next;
+static bool have_next = false;
+
+/* Previous record, for deltas. Same when recording and playing. */
+static uint32_t last_tick = 0;
+static int last_x = 0;
+static int last_y = 0;
+
+static uint32_t hits = 0;
+static uint32_t checksum = CHECKSUM_START;
+
+
+/* ----------------------------------------------
+ * Local functions
+ * ----------------------------------------------
+ */
+
+static void reset(void)
+{
+   last_tick = 0;
+   last_x = 0;
+   last_y = 0;
+   hits = 0;
+   checksum = CHECKSUM_START;
+}
+
+
+static void put_varint(uint64_t v)
+{
+   while (v >= 0x80) {
+      putc((int)(v & 0x7f) | 0x80, rec_fp);
+      v >>= 7;
+   }
+   putc((int)v, rec_fp);
+}
+
+
+static inline uint64_t zigzag(int v)
+{
+   return ((uint64_t)(unsigned int)v << 1) ^ (uint64_t)(v >> 31);
+}
+
+
+static inline int unzigzag(uint64_t v)
+{
+   return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+
+static void put_record(enum replay_type_t type, uint32_t tick)
+{
+   putc(type, rec_fp);
+   put_varint(tick - last_tick);
+   last_tick = tick;
+}
+
+
+static bool get_varint(uint64_t *v)
+{
+   int shift = 0;
+   unsigned char b;
+
+   *v = 0;
+   do {
+      if (unlikely(play_pos >= play_size || shift > 63)) {
+         return false;
+      }
+      b = play_buf[play_pos++];
+      *v |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+   } while (b & 0x80);
+
+   return true;
+}
+
+
+/* Decode the next record into next, false at end or if broken */
+static bool get_record(void)
+{
+   uint64_t type, dt, a, b, c;
+
+   if (play_pos >= play_size) {
+      WARN("Replay ended without end record");
+      return false;
+   }
+   type = play_buf[play_pos++];
+   if (!get_varint(&dt)) {
+      goto broken;
+   }
+   memset(&next, 0, sizeof(next));
+   next.type = (enum replay_type_t)type;
+   last_tick += (uint32_t)dt;
+   next.tick = last_tick;
+
+   switch (type) {
+   case Replay_level:
+      if (!get_varint(&a) || a >= sizeof(next.level) || play_pos + a > play_size) {
+         goto broken;
+      }
+      memcpy(next.level, play_buf + play_pos, a);
+      next.level[a] = '\0';
+      play_pos += a;
+      break;
+   case Replay_click:
+      if (!get_varint(&a) || !get_varint(&b) || !get_varint(&c)) {
+         goto broken;
+      }
+      next.offset = (int)a;
+      last_x += unzigzag(b);
+      last_y += unzigzag(c);
+      next.x = last_x;
+      next.y = last_y;
+      break;
+   case Replay_key:
+   case Replay_quality:
+      if (!get_varint(&a)) {
+         goto broken;
+      }
+      next.value = (int)a;
+      break;
+   case Replay_end:
+      if (!get_varint(&a) || !get_varint(&b) || !get_varint(&c)) {
+         goto broken;
+      }
+      next.value = unzigzag(a);
+      next.hits = (uint32_t)b;
+      next.checksum = (uint32_t)c;
+      break;
+   default:
+      goto broken;
+   }
+
+   return true;
+
+broken:
+
+   WARN("Broken replay record at byte %lu", (unsigned long)play_pos);
+   return false;
+}
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+bool replay_record(const char *filename, uint64_t seed)
+{
+   if (!(rec_fp = fopen(filename, "wb"))) {
+      perror(filename);
+      return false;
+   }
+   reset();
+   fwrite(REPLAY_MAGIC, 4, 1, rec_fp);
+   putc(REPLAY_VERSION, rec_fp);
+   put_varint(seed);
+
+   return true;
+}
+
+
+bool replay_play(const char *filename, uint64_t *seed)
+{
+   FILE *fp;
+   long size;
+   bool ret = false;
+
+   if (!(fp = fopen(filename, "rb"))) {
+      perror(filename);
+      return false;
+   }
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   if (size < 5) {
+      WARN("%s: too short for a replay", filename);
+      goto out;
+   }
+   play_buf = (unsigned char *)malloc(size);
+   if (unlikely(!play_buf)) {
+      WARN("malloc failed");
+      goto out;
+   }
+   if (fread(play_buf, 1, size, fp) != (size_t)size) {
+      perror(filename);
+      goto out;
+   }
+   if (memcmp(play_buf, REPLAY_MAGIC, 4) != 0 || play_buf[4] != REPLAY_VERSION) {
+      WARN("%s: not a version %d replay", filename, REPLAY_VERSION);
+      goto out;
+   }
+   reset();
+   play_size = size;
+   play_pos = 5;
+   if (!get_varint(seed)) {
+      WARN("%s: no seed", filename);
+      goto out;
+   }
+
+   ret = true;
+
+out:
+
+   if (!ret) {
+      free(play_buf);
+      play_buf = NULL;
+   }
+   fclose(fp);
+
+   return ret;
+}
+
+
+bool replay_playing(void)
+{
+   return play_buf != NULL;
+}
+
+
+void replay_level(uint32_t tick, const char *name)
+{
+   size_t len;
+
+   if (rec_fp) {
+      len = strlen(name);
+      put_record(Replay_level, tick);
+      put_varint(len);
+      fwrite(name, 1, len, rec_fp);
+   }
+}
+
+
+void replay_click(uint32_t tick, int offset, int x, int y)
+{
+   if (rec_fp) {
+      put_record(Replay_click, tick);
+      put_varint(offset);
+      put_varint(zigzag(x - last_x));
+      put_varint(zigzag(y - last_y));
+      last_x = x;
+      last_y = y;
+   }
+}
+
+
+void replay_key(uint32_t tick, int key)
+{
+   if (rec_fp) {
+      put_record(Replay_key, tick);
+      put_varint(key);
+   }
+}
+
+
+void replay_quality(uint32_t tick, int q)
+{
+   if (rec_fp) {
+      put_record(Replay_quality, tick);
+      put_varint(q);
+   }
+}
+
+
+void replay_hit(uint32_t tick, int target, int score)
+{
+   uint32_t v[3] = { tick, (uint32_t)target, (uint32_t)score };
+   int i, j;
+
+   /* Byte by byte, low first, same on any endian */
+   for (i = 0; i < 3; i++) {
+      for (j = 0; j < 32; j += 8) {
+         checksum = (checksum ^ ((v[i] >> j) & 0xff)) * CHECKSUM_PRIME;
+      }
+   }
+   hits++;
+}
+
+
+const struct replay_event_t *replay_peek(void)
+{
+   if (!play_buf) {
+      return NULL;
+   }
+   if (!have_next) {
+      have_next = get_record();
+      if (!have_next) {
+         /* Stay at the end */
+         play_pos = play_size;
+      }
+   }
+
+   return have_next ? &next : NULL;
+}
+
+
+void replay_pop(void)
+{
+   have_next = false;
+}
+
+
+bool replay_close(uint32_t tick, int total_score)
+{
+   const struct replay_event_t *e;
+   bool ret = true;
+
+   if (rec_fp) {
+      put_record(Replay_end, tick);
+      put_varint(zigzag(total_score));
+      put_varint(hits);
+      put_varint(checksum);
+      if (fclose(rec_fp) != 0) {
+         perror("replay");
+         ret = false;
+      }
+      rec_fp = NULL;
+   }
+
+   if (play_buf) {
+      e = replay_peek();
+      if (!e || e->type != Replay_end || e->tick != tick) {
+         printf("REPLAY: stopped at step %u before the end\n", tick);
+         ret = false;
+      } else if (e->value != total_score || e->hits != hits || e->checksum != checksum) {
+         printf("REPLAY: MISMATCH, score %d hits %u (%08x), recorded %d hits %u (%08x)\n",
+                total_score, hits, checksum, e->value, e->hits, e->checksum);
+         ret = false;
+      } else {
+         printf("REPLAY: OK, score %d hits %u (%08x)\n", total_score, hits, checksum);
+      }
+      free(play_buf);
+      play_buf = NULL;
+      have_next = false;
+   }
+
+   return ret;
+}
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
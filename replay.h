@@ -0,0 +1,115 @@
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+/**
+ * @file replay.h
+ * @brief Record and play back the input of a game.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* ----------------------------------------------
+ * Exported types
+ * ----------------------------------------------
+ */
+
+enum replay_type_t {
+   Replay_level = 1,
+   Replay_click,
+   Replay_key,
+   Replay_quality,
+   Replay_end
+};
+
+/* One recorded event. tick is the simulation step it happened in. */
+struct replay_event_t {
+   enum replay_type_t type;
+   uint32_t tick;
+   /* Click: ns into the step and position */
+   int offset;
+   int x, y;
+   /* Key: key character. Quality: tier. End: total score. */
+   int value;
+   /* End: number of hits and checksum of them */
+   uint32_t hits;
+   uint32_t checksum;
+   /* Level: file name */
+   char level[64];
+};
+
+
+/* ----------------------------------------------
+ * Exported functions from replay.c
+ * ----------------------------------------------
+ */
+
+/* Start recording to filename */
+bool replay_record(const char *filename, uint64_t seed);
+/* Start playing back filename, gives the seed it was recorded with */
+bool replay_play(const char *filename, uint64_t *seed);
+bool replay_playing(void);
+
+/* Record events, no-ops unless recording */
+void replay_level(uint32_t tick, const char *name);
+void replay_click(uint32_t tick, int offset, int x, int y);
+void replay_key(uint32_t tick, int key);
+void replay_quality(uint32_t tick, int q);
+
+/* Add a hit to the checksum, when recording and playing back */
+void replay_hit(uint32_t tick, int target, int score);
+
+/* Next event to play back, NULL at end of file */
+const struct replay_event_t *replay_peek(void);
+void replay_pop(void);
+
+/* Record the end, or check that playback ended like the recording.
+ * Returns false if playback differs. */
+bool replay_close(uint32_t tick, int total_score);
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
+
+#endif  /* __REPLAY_H */
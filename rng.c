@@ -0,0 +1,97 @@
+/**
+ * @file rng.c
+ * @brief PCG32 random number streams.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include "rng.h"
+
+
+/* From the PCG reference implementation, pcg32_random_r */
+#define PCG_MULT 6364136223846793005ULL
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+void rng_seed(struct rng_t *r, uint64_t seed, uint64_t stream)
+{
+   r->state = 0;
+   /* Must be odd */
+   r->inc = (stream << 1) | 1;
+   rng_u32(r);
+   r->state += seed;
+   rng_u32(r);
+}
+
+
+uint32_t rng_u32(struct rng_t *r)
+{
+   uint64_t old = r->state;
+   uint32_t xorshifted, rot;
+
+   r->state = old * PCG_MULT + r->inc;
+   xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+   rot = (uint32_t)(old >> 59);
+
+   return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+
+/* Multiply and shift instead of modulo, bias is below 2^-32 * n */
+int rng_below(struct rng_t *r, int n)
+{
+   return (int)(((uint64_t)rng_u32(r) * (uint32_t)n) >> 32);
+}
+
+
+/* 24 random bits, all a float can hold */
+float rng_float(struct rng_t *r)
+{
+   return (rng_u32(r) >> 8) * (1.0f / 16777216.0f);
+}
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
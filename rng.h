@@ -0,0 +1,84 @@
+#ifndef __RNG_H
+#define __RNG_H
+
+/**
+ * @file rng.h
+ * @brief Seedable random number streams.
+ */
+
+/************************************************************************
+ *      ___                 _            _
+ * B   / __\__ _ _ __ _ __ (_)_   ____ _| |
+ * O  / /  / _` | '__| '_ \| \ \ / / _` | |
+ * O / /__| (_| | |  | | | | |\ V / (_| | |
+ * M \____/\__,_|_|  |_| |_|_| \_/ \__,_|_|
+ *
+ * $Id: $
+ *
+ * Authors
+ *  - Albert Veli
+ *
+ * Copyright (C) 2007 Albert Veli
+ *
+ * ------------------------------
+ *
+ * This file is part of Carnival
+ *
+ * Carnival is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Carnival is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ ************************************************************************/
+
+#include <stdint.h>
+
+
+/* ----------------------------------------------
+ * Exported types
+ * ----------------------------------------------
+ */
+
+/* PCG32 generator. The state is two plain integers, so a stream is
+ * snapshotted and restored by copying the struct. Streams seeded
+ * with the same seed but different stream numbers are independent.
+ */
+struct rng_t {
+   uint64_t state;
+   uint64_t inc;
+};
+
+
+/* ----------------------------------------------
+ * Exported functions from rng.c
+ * ----------------------------------------------
+ */
+
+void rng_seed(struct rng_t *r, uint64_t seed, uint64_t stream);
+/* Uniform 32 bits */
+uint32_t rng_u32(struct rng_t *r);
+/* Uniform in [0, n), n > 0 */
+int rng_below(struct rng_t *r, int n);
+/* Uniform in [0, 1) */
+float rng_float(struct rng_t *r);
+
+
+/**
+ * GNU Emacs settings: K&R with 3 spaces indent.
+ * Local Variables:
+ * c-file-style: "k&r"
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
+
+#endif  /* __RNG_H */
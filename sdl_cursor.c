@@ -93,7 +93,7 @@ static const char *haircross[] = {
 
 static const char *haircross2[] = {
    /* width height num_colors chars_per_pixel */
-   "32 32 3 1",
+   "32 32 4 1",
    /* colors */
    "X c #000000",
    ". c #FFFFFF",
@@ -139,17 +139,48 @@ static const char *haircross2[] = {
 static SDL_Cursor *cursor;
 static SDL_Cursor *cursor2;
 
+/* Software crosshair, drawn into the frame just before the flip */
+#define CURSOR_SIZE 32
+/* Transparent pixels of soft_cursor */
+#define CURSOR_KEY 0xff00ff
+
+struct backing_t {
+   /* What the crosshair covers */
+   SDL_Surface *save;
+   SDL_Rect rect;
+   bool valid;
+};
+
+static bool soft = false;
+static bool alternative = false;
+static SDL_Surface *soft_cursor[2];
+static int hot_x[2], hot_y[2];
+/* One per screen buffer */
+static struct backing_t backing[2];
+static int back = 0;
+
 
 /* ----------------------------------------------
  * Local functions
  * ----------------------------------------------
  */
+/* Index of the first pixel row in image */
+static int first_row(const char *image[])
+{
+  int ncolors = 0;
+
+  sscanf(image[0], "%*d %*d %d", &ncolors);
+  return 1 + ncolors;
+}
+
+
 static SDL_Cursor *init_system_cursor(const char *image[])
 {
   int i, row, col;
   Uint8 data[4*32];
   Uint8 mask[4*32];
   int hot_x, hot_y;
+  int first = first_row(image);
 
   i = -1;
   for ( row=0; row<32; ++row ) {
@@ -161,7 +192,7 @@ static SDL_Cursor *init_system_cursor(const char *image[])
         ++i;
         data[i] = mask[i] = 0;
       }
-      switch (image[4+row][col]) {
+      switch (image[first+row][col]) {
         case 'X':
           data[i] |= 0x01;
           mask[i] |= 0x01;
@@ -174,18 +205,86 @@ static SDL_Cursor *init_system_cursor(const char *image[])
       }
     }
   }
-  sscanf(image[4+row], "%d,%d", &hot_x, &hot_y);
+  sscanf(image[first+row], "%d,%d", &hot_x, &hot_y);
   return SDL_CreateCursor(data, mask, 32, 32, hot_x, hot_y);
 }
 
 
+/* Same image as init_system_cursor() but as a colorkeyed surface */
+static SDL_Surface *init_soft_cursor(const char *image[], int *hx, int *hy)
+{
+   SDL_Surface *s, *d;
+   Uint32 *p;
+   int row, col;
+   int first = first_row(image);
+
+   s = SDL_CreateRGBSurface(SDL_SWSURFACE, CURSOR_SIZE, CURSOR_SIZE, 32,
+                            0xff0000, 0x00ff00, 0x0000ff, 0);
+   if (unlikely(!s)) {
+      return NULL;
+   }
+   SDL_LockSurface(s);
+   for (row = 0; row < CURSOR_SIZE; row++) {
+      p = (Uint32 *)((Uint8 *)s->pixels + row * s->pitch);
+      for (col = 0; col < CURSOR_SIZE; col++) {
+         switch (image[first + row][col]) {
+         case 'X':
+            p[col] = 0x000000;
+            break;
+         case '.':
+         case '+':
+            p[col] = 0xffffff;
+            break;
+         default:
+            p[col] = CURSOR_KEY;
+            break;
+         }
+      }
+   }
+   SDL_UnlockSurface(s);
+   sscanf(image[first + CURSOR_SIZE], "%d,%d", hx, hy);
+
+   SDL_SetColorKey(s, SDL_SRCCOLORKEY | SDL_RLEACCEL, CURSOR_KEY);
+   d = SDL_DisplayFormat(s);
+   SDL_FreeSurface(s);
+
+   return d;
+}
+
+
 /* ----------------------------------------------
  * Exported functions
  * ----------------------------------------------
  */
 
+void custom_cursor_software(bool on)
+{
+   soft = on;
+}
+
+
 void custom_cursor_init(void)
 {
+   int i;
+
+   if (soft) {
+      soft_cursor[0] = init_soft_cursor(haircross, &hot_x[0], &hot_y[0]);
+      soft_cursor[1] = init_soft_cursor(haircross2, &hot_x[1], &hot_y[1]);
+      for (i = 0; i < 2; i++) {
+         backing[i].save = SDL_CreateRGBSurface(SDL_SWSURFACE, CURSOR_SIZE, CURSOR_SIZE,
+                                                screen->format->BitsPerPixel,
+                                                screen->format->Rmask, screen->format->Gmask,
+                                                screen->format->Bmask, 0);
+         backing[i].valid = false;
+      }
+      if (unlikely(!soft_cursor[0] || !soft_cursor[1] || !backing[0].save || !backing[1].save)) {
+         WARN("Software crosshair -> %s", SDL_GetError());
+         exit(1);
+      }
+      SDL_ShowCursor(0);
+      return;
+   }
+
    /* Set custom cursor */
    cursor = init_system_cursor(haircross);
    if (unlikely(!cursor)) {
@@ -204,6 +303,10 @@ void custom_cursor_init(void)
 
 void custom_cursor_alternative(bool alt)
 {
+   alternative = alt;
+   if (soft) {
+      return;
+   }
    if (alt) {
       SDL_SetCursor(cursor2);
    } else {
@@ -212,8 +315,67 @@ void custom_cursor_alternative(bool alt)
 }
 
 
+/* Sample the mouse as late as possible and draw the crosshair on
+ * top of the frame. If nothing else was drawn since the last time
+ * only the crosshair area is repainted, and on a single buffered
+ * screen only the old and new crosshair rects are updated.
+ */
+bool custom_cursor_draw(bool redrawn)
+{
+   struct backing_t *b = &backing[back];
+   /* Clipped to the screen by the blits, as SDL_UpdateRects wants */
+   SDL_Rect dirty[2];
+   SDL_Rect r;
+   int n = 0;
+   int x, y;
+
+   if (!soft) {
+      return false;
+   }
+
+   if (!redrawn && b->valid) {
+      dirty[n] = b->rect;
+      SDL_BlitSurface(b->save, NULL, screen, &dirty[n]);
+      n++;
+   }
+
+   SDL_PumpEvents();
+   SDL_GetMouseState(&x, &y);
+   b->rect.x = x - hot_x[alternative];
+   b->rect.y = y - hot_y[alternative];
+   b->rect.w = CURSOR_SIZE;
+   b->rect.h = CURSOR_SIZE;
+
+   r = b->rect;
+   SDL_BlitSurface(screen, &r, b->save, NULL);
+   b->valid = true;
+   dirty[n] = b->rect;
+   SDL_BlitSurface(soft_cursor[alternative], NULL, screen, &dirty[n]);
+   n++;
+
+   if (screen->flags & SDL_DOUBLEBUF) {
+      /* Next flip draws into the other buffer */
+      back = 1 - back;
+   } else if (!redrawn) {
+      SDL_UpdateRects(screen, n, dirty);
+      return true;
+   }
+
+   return false;
+}
+
+
 void custom_cursor_free(void)
 {
+   int i;
+
+   if (soft) {
+      for (i = 0; i < 2; i++) {
+         SDL_FreeSurface(soft_cursor[i]);
+         SDL_FreeSurface(backing[i].save);
+      }
+      return;
+   }
    SDL_ShowCursor(0);
    SDL_FreeCursor(cursor);
 }
@@ -40,8 +40,18 @@
  *
  ************************************************************************/
 
+/* Draw the crosshair in software instead of as a hardware cursor.
+ * Call before custom_cursor_init().
+ */
+void custom_cursor_software(bool on);
 void custom_cursor_init(void);
 void custom_cursor_alternative(bool alt);
+/* Call just before video_flip(), redrawn tells if the whole
+ * frame was drawn since the last flip. No-op for hardware cursor.
+ * Returns true if only the crosshair moved and it already updated
+ * those parts of the screen, then skip video_flip().
+ */
+bool custom_cursor_draw(bool redrawn);
 void custom_cursor_free(void);
 
 
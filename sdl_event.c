@@ -39,47 +39,201 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "carnival.h"
 
 
+/* Events in the ring, power of two */
+#define INPUT_RING 256
+/* How long the input thread sleeps when SDL has no events */
+#define INPUT_POLL_NS 250000
+
+
 /* ----------------------------------------------
- * Exported functions
+ * Structs
  * ----------------------------------------------
  */
 
-void handle_events(void)
-{
-   SDL_Event event;
+/* An event as read by the input thread */
+struct input_t {
+   Uint8 type;
+   SDLKey key;
    int x, y;
+   long long t;
+};
 
-   while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-      case SDL_MOUSEBUTTONDOWN:
-         /* Get mouse position */
-         SDL_GetMouseState(&x, &y);
-         mouse_clicked(x, y);
+
+/* ----------------------------------------------
+ * Local variables
+ * ----------------------------------------------
+ */
+
+/* Single producer (input thread), single consumer (main loop).
+ * ring_head is only written by the producer and ring_tail only by
+ * the consumer, so no lock is needed, only barriers. */
+static struct input_t ring[INPUT_RING];
+static volatile unsigned int ring_head = 0;
+static volatile unsigned int ring_tail = 0;
+static unsigned int ring_dropped = 0;
+
+static SDL_Thread *input_thread = NULL;
+static volatile bool input_quit = false;
+
+
+/* ----------------------------------------------
+ * Local functions
+ * ----------------------------------------------
+ */
+
+/* Returns false for events nobody listens to */
+static bool input_from_event(struct input_t *in, const SDL_Event *event)
+{
+   if (event->type != SDL_MOUSEBUTTONDOWN && event->type != SDL_KEYDOWN &&
+       event->type != SDL_QUIT) {
+      return false;
+   }
+   /* SDL 1.2 events have no time, use when they are read */
+   in->t = profile_time();
+   in->type = event->type;
+   in->key = event->type == SDL_KEYDOWN ? event->key.keysym.sym : SDLK_UNKNOWN;
+   /* Position of the click, not where the mouse is now */
+   in->x = event->type == SDL_MOUSEBUTTONDOWN ? event->button.x : 0;
+   in->y = event->type == SDL_MOUSEBUTTONDOWN ? event->button.y : 0;
+
+   return true;
+}
+
+
+static void dispatch(const struct input_t *in)
+{
+   switch (in->type) {
+   case SDL_MOUSEBUTTONDOWN:
+      profile_input(in->t, frames);
+      mouse_clicked(in->x, in->y, in->t);
+      break;
+   case SDL_KEYDOWN:
+      /* Quit if key is escape or q */
+      switch (in->key) {
+      case SDLK_ESCAPE:
+      case SDLK_q:
+         escape_pressed();
          break;
-      case SDL_KEYDOWN:
-         /* Quit if key is escape or q */
-         switch (event.key.keysym.sym) {
-         case SDLK_ESCAPE:
-         case SDLK_q:
-            escape_pressed();
-            break;
-         case SDLK_p:
-            pause_pressed();
-            break;
-         default:
-            break;
-         }
+      case SDLK_p:
+         pause_pressed();
          break;
-      case SDL_QUIT:
-         escape_pressed();
+      case SDLK_t:
+         timing_pressed();
+         break;
+      case SDLK_h:
+         hud_pressed();
          break;
       default:
          break;
       }
+      break;
+   case SDL_QUIT:
+      escape_pressed();
+      break;
+   default:
+      break;
+   }
+}
+
+
+/* Takes events off the SDL queue as soon as the event thread puts
+ * them there and stamps them with the time they were seen. */
+static int input_main(void *data UNUSED)
+{
+   SDL_Event event;
+   struct timespec idle = { 0, INPUT_POLL_NS };
+   struct input_t in;
+   unsigned int head = ring_head;
+
+   while (!input_quit) {
+      if (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) <= 0) {
+         nanosleep(&idle, NULL);
+         continue;
+      }
+      if (!input_from_event(&in, &event)) {
+         continue;
+      }
+      if (unlikely(head - ring_tail == INPUT_RING)) {
+         ring_dropped++;
+         continue;
+      }
+      ring[head & (INPUT_RING - 1)] = in;
+      /* Entry must be visible before the new head */
+      __sync_synchronize();
+      ring_head = ++head;
+   }
+
+   return 0;
+}
+
+
+/* ----------------------------------------------
+ * Exported functions
+ * ----------------------------------------------
+ */
+
+/* Needs video_event_thread(true) before video_init, or SDL would
+ * have to be pumped from this thread, which it can't be in 1.2. */
+bool input_thread_start(void)
+{
+   if (!video_has_event_thread()) {
+      WARN("No SDL event thread, events are read by the main loop");
+      return false;
+   }
+   input_quit = false;
+   input_thread = SDL_CreateThread(input_main, NULL);
+   if (unlikely(!input_thread)) {
+      WARN("SDL_CreateThread -> %s", SDL_GetError());
+      return false;
+   }
+
+   return true;
+}
+
+
+void input_thread_stop(void)
+{
+   if (input_thread) {
+      input_quit = true;
+      SDL_WaitThread(input_thread, NULL);
+      input_thread = NULL;
+      if (ring_dropped) {
+         WARN("Input ring full, %u events dropped", ring_dropped);
+      }
+   }
+}
+
+
+void handle_events(void)
+{
+   SDL_Event event;
+   struct input_t in;
+   unsigned int tail, head;
+
+   if (input_thread) {
+      tail = ring_tail;
+      head = ring_head;
+      /* Don't read entries before the head that says they're there */
+      __sync_synchronize();
+      while (tail != head) {
+         dispatch(&ring[tail & (INPUT_RING - 1)]);
+         tail++;
+      }
+      /* Done reading before the producer may overwrite */
+      __sync_synchronize();
+      ring_tail = tail;
+      return;
+   }
+
+   while (SDL_PollEvent(&event)) {
+      if (input_from_event(&in, &event)) {
+         dispatch(&in);
+      }
    }
 }
 
@@ -40,6 +40,10 @@
  *
  ************************************************************************/
 
+/* Read events in a thread of their own, timestamped as they arrive */
+bool input_thread_start(void);
+void input_thread_stop(void);
+/* Dispatch events to the callbacks in carnival.h */
 void handle_events(void);
 
 
@@ -205,6 +205,7 @@ int zoomSurfaceRGBA(SDL_Surface * src, SDL_Surface * dst, int flipx, int flipy,
     /*
      * Allocate memory for row increments
      */
+    COUNT(Count_zoom_mallocs, 2);
     if (unlikely((sax = (int *) malloc((dst->w + 1) * sizeof(Uint32))) == NULL)) {
 	return (-1);
     }
@@ -385,6 +386,7 @@ int zoomSurfaceY(SDL_Surface * src, SDL_Surface * dst)
     /*
      * Allocate memory for row increments
      */
+    COUNT(Count_zoom_mallocs, 2);
     if (unlikely((sax = (Uint32 *) malloc(dst->w * sizeof(Uint32))) == NULL)) {
 	return (-1);
     }
@@ -770,6 +772,7 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
     int is32bit;
     int i, src_converted;
     int flipx,flipy;
+    TRACE_SCOPE("rotozoomSurfaceXY");
 
     /*
      * Sanity check
@@ -794,6 +797,7 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 	rz_src =
 	    SDL_CreateRGBSurface(SDL_SWSURFACE, src->w, src->h, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
 	SDL_BlitSurface(src, NULL, rz_src, NULL);
+	COUNT(Count_surfaces_created, 1);
 	src_converted = 1;
 	is32bit = 1;
     }
@@ -870,6 +874,11 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 				 (int) (sanglezoominv), (int) (canglezoominv),
 				 flipx, flipy,
 				 smooth);
+	    if (smooth) {
+		COUNT(Count_rz_rgba_smooth, 1);
+	    } else {
+		COUNT(Count_rz_rgba, 1);
+	    }
 	    /*
 	     * Turn on source-alpha support
 	     */
@@ -887,6 +896,7 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 	     */
 	    transformSurfaceY(rz_src, rz_dst, dstwidthhalf, dstheighthalf,
 			      (int) (sanglezoominv), (int) (canglezoominv));
+	    COUNT(Count_rz_8bit, 1);
 	    SDL_SetColorKey(rz_dst, SDL_SRCCOLORKEY | SDL_RLEACCEL, rz_src->format->colorkey);
 	}
 	/*
@@ -939,6 +949,11 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 	     * Call the 32bit transformation routine to do the zooming (using alpha)
 	     */
 	    zoomSurfaceRGBA(rz_src, rz_dst, flipx, flipy, smooth);
+	    if (smooth) {
+		COUNT(Count_zoom_rgba_smooth, 1);
+	    } else {
+		COUNT(Count_zoom_rgba, 1);
+	    }
 	    /*
 	     * Turn on source-alpha support
 	     */
@@ -955,6 +970,7 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 	     * Call the 8bit transformation routine to do the zooming
 	     */
 	    zoomSurfaceY(rz_src, rz_dst);
+	    COUNT(Count_zoom_8bit, 1);
 	    SDL_SetColorKey(rz_dst, SDL_SRCCOLORKEY | SDL_RLEACCEL, rz_src->format->colorkey);
 	}
 	/*
@@ -963,11 +979,16 @@ SDL_Surface *rotozoomSurfaceXY(SDL_Surface * src, double radangle, double zoomx,
 	SDL_UnlockSurface(rz_src);
     }
 
+    COUNT(Count_surfaces_created, 1);
+    COUNT(Count_pixels_read, rz_src->w * rz_src->h);
+    COUNT(Count_pixels_written, dstwidth * dstheight);
+
     /*
      * Cleanup temp surface
      */
     if (src_converted) {
 	SDL_FreeSurface(rz_src);
+	COUNT(Count_surfaces_freed, 1);
     }
 
     /*
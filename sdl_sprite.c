@@ -43,6 +43,41 @@
 #include "sdl_sprite.h"
 #include "sdl_rotozoom.h"
 
+#ifdef EMBED_ASSETS
+#include <zlib.h>
+#include <unistd.h>
+
+/* Png file name -> compressed surface */
+struct embedded_t {
+   const char *filename;
+   struct comp_surf_t *surf;
+};
+
+/* Generated from png/ by tools/pngembed */
+#include "assets.h"
+
+#define NUM_EMBEDDED ((int)(sizeof(embedded) / sizeof(embedded[0])) - 1)
+#define INFLATE_MAX_THREADS 16
+
+/* Every stride:th asset starting at first is inflated by one thread */
+struct inflate_job_t {
+   int first;
+   int stride;
+};
+#endif
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+#define RMASK 0xff000000
+#define GMASK 0x00ff0000
+#define BMASK 0x0000ff00
+#define AMASK 0x000000ff
+#else
+#define RMASK 0x000000ff
+#define GMASK 0x0000ff00
+#define BMASK 0x00ff0000
+#define AMASK 0xff000000
+#endif
+
 /* Pixel array allocated for each sprite and not freed until sprite_free()
  * is called.
  */
@@ -56,6 +91,16 @@ static char *pixels[MAX_SPRITES] = {
 };
 
 
+/* Rotozoom quality, see sprite_rotozoom_quality() */
+static int rz_smooth = SMOOTHING_OFF;
+static float rz_angle_step = 0;
+
+/* Hit test against a mask after this many tests of the same
+ * spr_trans, see sprite_collide_masks() */
+#define SPRITE_MASK_TESTS 8
+static bool use_masks = true;
+
+
 #define PNG_BYTES_TO_CHECK 4
 static SDL_Surface *sdl_load_png(const char *filename, bool *rgba)
 {
@@ -66,6 +111,7 @@ static SDL_Surface *sdl_load_png(const char *filename, bool *rgba)
    png_uint_32 y;
    char *p;
    Uint32 rmask, gmask, bmask, amask;
+   TRACE_SCOPE("sdl_load_png");
    SDL_Surface *s = NULL;
    char *pixelp;
    int i = 0;
@@ -128,17 +174,10 @@ static SDL_Surface *sdl_load_png(const char *filename, bool *rgba)
    /* XXX: Replace with png_read_info(png_ptr, info_ptr) ? */
    png_read_png(png_ptr, info_ptr, 0, NULL);
 
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-   rmask = 0xff000000;
-   gmask = 0x00ff0000;
-   bmask = 0x0000ff00;
-   amask = 0x000000ff;
-#else
-   rmask = 0x000000ff;
-   gmask = 0x0000ff00;
-   bmask = 0x00ff0000;
-   amask = 0xff000000;
-#endif
+   rmask = RMASK;
+   gmask = GMASK;
+   bmask = BMASK;
+   amask = AMASK;
 
    bit_depth = png_get_bit_depth(png_ptr, info_ptr);
    color_type = png_get_color_type(png_ptr, info_ptr);
@@ -219,6 +258,174 @@ out2:
 }
 
 
+#ifdef EMBED_ASSETS
+static int inflate_main(void *data)
+{
+   struct inflate_job_t *job = (struct inflate_job_t *)data;
+   struct comp_surf_t *c;
+   uLongf ulen;
+   int i;
+
+   for (i = job->first; i < NUM_EMBEDDED; i += job->stride) {
+      c = embedded[i].surf;
+      c->udata = (unsigned char *)malloc(c->ulen);
+      if (!c->udata) {
+         WARN("malloc failed for %s", embedded[i].filename);
+         continue;
+      }
+      ulen = c->ulen;
+      if (uncompress(c->udata, &ulen, c->cdata, c->clen) != Z_OK || (int)ulen != c->ulen) {
+         WARN("Inflating %s failed", embedded[i].filename);
+         free(c->udata);
+         c->udata = NULL;
+      }
+   }
+
+   return 0;
+}
+
+
+/* Same as sdl_load_png() but from an inflated embedded png */
+static SDL_Surface *sdl_load_embedded(const char *filename, bool *rgba)
+{
+   struct comp_surf_t *c = NULL;
+   SDL_Surface *s;
+   SDL_Color colors[256];
+   char *p;
+   int i;
+
+   for (i = 0; i < NUM_EMBEDDED; i++) {
+      if (strcmp(filename, embedded[i].filename) == 0) {
+         c = embedded[i].surf;
+         break;
+      }
+   }
+   if (!c || !c->udata) {
+      return NULL;
+   }
+
+   if (c->bpp == 32) {
+      *rgba = true;
+      /* udata is never freed, no copy needed */
+      return SDL_CreateRGBSurfaceFrom(c->udata, c->w, c->h, 32, c->pitch,
+                                      RMASK, GMASK, BMASK, AMASK);
+   }
+
+   *rgba = false;
+   s = SDL_CreateRGBSurface(SDL_SWSURFACE, c->w, c->h, 8, RMASK, GMASK, BMASK, AMASK);
+   if (!s) {
+      return NULL;
+   }
+   if (SDL_MUSTLOCK(s)) {
+      SDL_LockSurface(s);
+   }
+   for (i = 0, p = (char *)s->pixels; i < c->h; i++, p += s->pitch) {
+      memcpy(p, c->udata + i * c->pitch, c->pitch);
+   }
+   for (i = 0; i < c->ncolors; i++) {
+      colors[i].r = c->palette[i * 3];
+      colors[i].g = c->palette[i * 3 + 1];
+      colors[i].b = c->palette[i * 3 + 2];
+   }
+   SDL_SetColors(s, colors, 0, c->ncolors);
+   if (SDL_MUSTLOCK(s)) {
+      SDL_UnlockSurface(s);
+   }
+
+   return s;
+}
+#endif
+
+
+/* Is pixel (x, y) of a locked 8-bit surface opaque? */
+static inline bool opaque_8bit(SDL_Surface *spr, int x, int y)
+{
+   Uint8 *p = (Uint8 *)spr->pixels + y * spr->pitch + x;
+
+   return *p != spr->format->colorkey;
+}
+
+
+/* Is pixel (x, y) of a locked 32-bit surface opaque? */
+static inline bool opaque_alpha(SDL_Surface *spr, int x, int y)
+{
+   Uint8 *p = (Uint8 *)spr->pixels + y * spr->pitch + x * 4;
+   Uint8 r, g, b, a;
+
+   SDL_GetRGBA(*(Uint32 *)p, spr->format, &r, &g, &b, &a);
+
+   return (a != 0);
+}
+
+
+/* spr_trans is a surface of the sprite's own */
+static inline bool own_trans(struct sprite_t *sprp)
+{
+   return sprp->spr_trans && sprp->spr_trans != sprp->spr &&
+      sprp->spr_trans != sprp->spr_shared;
+}
+
+
+/* Free the hit mask, spr_trans is about to change */
+static inline void drop_mask(struct sprite_t *sprp)
+{
+   free(sprp->mask);
+   sprp->mask = NULL;
+   sprp->mask_tests = 0;
+}
+
+
+/**
+ * Check if (x, y), relative to the sprite, hits an opaque pixel of
+ * spr_trans. Pixels are read until spr_trans has been tested
+ * SPRITE_MASK_TESTS times, then looked up in a mask made from them
+ * once, which needs no locking.
+ */
+static bool collide_pixel(struct sprite_t *sprp, int x, int y,
+                          bool (*opaque)(SDL_Surface *, int, int))
+{
+   SDL_Surface *spr = (SDL_Surface *)(sprp->spr_trans);
+   bool hit;
+   int i, j;
+
+   if (likely(sprp->mask && use_masks)) {
+      return sprp->mask[y * spr->w + x];
+   }
+
+   /* Must lock to access spr->pixels */
+   if (SDL_MUSTLOCK(spr)) {
+      SDL_LockSurface(spr);
+   }
+   if (use_masks && unlikely(++sprp->mask_tests == SPRITE_MASK_TESTS) &&
+       (sprp->mask = (Uint8 *)malloc(spr->w * spr->h))) {
+      COUNT(Count_pixels_read, spr->w * spr->h);
+      for (j = 0; j < spr->h; j++) {
+         for (i = 0; i < spr->w; i++) {
+            sprp->mask[j * spr->w + i] = opaque(spr, i, j);
+         }
+      }
+      hit = sprp->mask[y * spr->w + x];
+   } else {
+      hit = opaque(spr, x, y);
+   }
+
+   /* Unlock surface */
+   if (SDL_MUSTLOCK(spr)) {
+      SDL_UnlockSurface(spr);
+   }
+
+   return hit;
+}
+
+
+/* Check if x,y is inside sprite rect */
+#define inside_rect(sprp, x, y)                 \
+   ((x) >= (sprp)->rect.x &&                    \
+    (x) - (sprp)->rect.x < (sprp)->rect.w &&    \
+    (y) >= (sprp)->rect.y &&                    \
+    (y) - (sprp)->rect.y < (sprp)->rect.h)
+
+
 /**
  * Check if coord x, y collides with sprp
  * @arg sprp Pointer to a struct sprite_t.
@@ -228,15 +435,7 @@ out2:
  */
 static bool sprite_collide_8bit(struct sprite_t *sprp, int x, int y)
 {
-   SDL_Surface *spr;
-   Uint8 *p;
-   Uint32 pixelcolor;
-
-   /* Check if x,y is inside sprite rect */
-   if (!((x >= sprp->rect.x) &&
-         (x - sprp->rect.x < sprp->rect.w) &&
-         (y >= sprp->rect.y) &&
-         (y - sprp->rect.y < sprp->rect.h))) {
+   if (!inside_rect(sprp, x, y)) {
       /* Outside, no collision */
       return false;
    }
@@ -247,20 +446,7 @@ static bool sprite_collide_8bit(struct sprite_t *sprp, int x, int y)
    }
 
    /* Transparent, check if x,y is transparent */
-   spr = (SDL_Surface *)(sprp->spr_trans);
-   /* Must lock to access spr->pixels */
-   if (SDL_MUSTLOCK(spr)) {
-      SDL_LockSurface(spr);
-   }
-   p = (Uint8 *)spr->pixels + (y - sprp->rect.y) * spr->pitch + (x - sprp->rect.x);
-   pixelcolor = *p;
-
-   /* Unlock surface */
-   if (SDL_MUSTLOCK(spr)) {
-      SDL_UnlockSurface(spr);
-   }
-
-   return pixelcolor != spr->format->colorkey;
+   return collide_pixel(sprp, x - sprp->rect.x, y - sprp->rect.y, opaque_8bit);
 }
 
 
@@ -273,16 +459,7 @@ static bool sprite_collide_8bit(struct sprite_t *sprp, int x, int y)
  */
 static bool sprite_collide_alpha(struct sprite_t *sprp, int x, int y)
 {
-   SDL_Surface *spr;
-   Uint8 *p;
-   Uint32 pixelcolor;
-   Uint8 r, g, b, a;
-
-   /* Check if x,y is inside sprite rect */
-   if (!((x >= sprp->rect.x) &&
-         (x - sprp->rect.x < sprp->rect.w) &&
-         (y >= sprp->rect.y) &&
-         (y - sprp->rect.y < sprp->rect.h))) {
+   if (!inside_rect(sprp, x, y)) {
       /* Outside, no collision */
       return false;
    }
@@ -293,22 +470,65 @@ static bool sprite_collide_alpha(struct sprite_t *sprp, int x, int y)
    }
 
    /* Transparent, check if x,y is transparent */
-   spr = (SDL_Surface *)(sprp->spr_trans);
-   /* Must lock to access spr->pixels */
-   if (SDL_MUSTLOCK(spr)) {
-      SDL_LockSurface(spr);
+   return collide_pixel(sprp, x - sprp->rect.x, y - sprp->rect.y, opaque_alpha);
+}
+
+
+/**
+ * Decode a png into a software surface, without touching the display.
+ * @arg sprp Pointer to a struct sprite_t.
+ * @arg trans Is sprite transparent?
+ * @arg embedded Use the copy built into the binary, if there is one
+ * @return 1 OK, 0 Error
+ */
+static int decode_png(struct sprite_t *sprp, const char *filename, bool trans, bool embedded)
+{
+   SDL_Surface *spr;
+   bool rgba;
+
+   /* TODO: Detect trans in sdl_load_png(). Don't send as parameter. */
+
+   sprp->trans = trans;
+
+   spr = NULL;
+#ifdef EMBED_ASSETS
+   if (embedded) {
+      spr = sdl_load_embedded(filename, &rgba);
+   }
+#else
+   (void)embedded;
+#endif
+   if (!spr) {
+      spr = sdl_load_png(filename, &rgba);
    }
-   p = (Uint8 *)spr->pixels + (y - sprp->rect.y) * spr->pitch + (x - sprp->rect.x) * 4;
-   pixelcolor = *(Uint32 *)p;
+   if (!spr) {
+      WARN("load_png %s failed", filename);
+      return 0;
+   }
+   COUNT(Count_surfaces_created, 1);
 
-   /* Unlock surface */
-   if (SDL_MUSTLOCK(spr)) {
-      SDL_UnlockSurface(spr);
+   if (rgba) {
+      sprp->sprite_collide = sprite_collide_alpha;
+   } else {
+      sprp->sprite_collide = sprite_collide_8bit;
    }
 
-   SDL_GetRGBA(pixelcolor, spr->format, &r, &g, &b, &a);
+   sprp->spr = spr;
+   /* Set by sprite_display_format() */
+   sprp->spr_trans = NULL;
 
-   return (a != 0);
+   sprp->rect.x = 0;
+   sprp->rect.y = 0;
+   sprp->rect.w = spr->w;
+   sprp->rect.h = spr->h;
+   sprp->delta_w = 0;
+   sprp->delta_h = 0;
+   sprp->rz_valid = false;
+   sprp->mask = NULL;
+   sprp->mask_tests = 0;
+   sprp->spr_shared = NULL;
+
+   return 1;
 }
 
 
@@ -326,8 +546,11 @@ void sprite_erase(struct sprite_t *sprp)
 
    if (likely(sprp->spr_trans != sprp->spr)) {
       SDL_FreeSurface((SDL_Surface *)sprp->spr_trans);
+      COUNT(Count_surfaces_freed, 1);
       sprp->spr_trans = NULL;
    }
+   sprp->rz_valid = false;
+   drop_mask(sprp);
 }
 
 
@@ -336,12 +559,15 @@ void sprite_free(struct sprite_t *s)
 {
    int i = 0;
 
-   if (s->spr != s->spr_trans) {
+   if (s->spr_trans && s->spr != s->spr_trans) {
       SDL_FreeSurface((SDL_Surface *)s->spr_trans);
+      COUNT(Count_surfaces_freed, 1);
    }
    SDL_FreeSurface((SDL_Surface *)s->spr);
+   COUNT(Count_surfaces_freed, 1);
    s->spr = NULL;
    s->spr_trans = NULL;
+   drop_mask(s);
 
    /* Take the easy way and just free all first time */
    for (i = 0; i < MAX_SPRITES; i++) {
@@ -353,33 +579,20 @@ void sprite_free(struct sprite_t *s)
 }
 
 
-/**
- * Load sprite from bitmap.
- * @arg sprp Pointer to a struct sprite_t.
- * @arg trans Is sprite transparent?
- * @arg eightbit Set to true if sprite is going to be rotated later.
- * @return 1 OK, 0 Error
- */
-int sprite_load_from_png(struct sprite_t *sprp, const char *filename, bool trans)
+int sprite_decode_png(struct sprite_t *sprp, const char *filename, bool trans)
 {
-   SDL_Surface *temp;
-   SDL_Surface *spr = (SDL_Surface *)sprp->spr;
-   bool rgba;
-
-   /* TODO: Detect trans in sdl_load_png(). Don't send as parameter. */
+   return decode_png(sprp, filename, trans, true);
+}
 
-   sprp->trans = trans;
 
-   spr = sdl_load_png(filename, &rgba);
-   if (!spr) {
-      WARN("load_png %s failed", filename);
-      return 0;
-   }
+/* Reads the display format, main thread only */
+int sprite_display_format(struct sprite_t *sprp)
+{
+   SDL_Surface *temp;
+   SDL_Surface *spr = (SDL_Surface *)sprp->spr;
 
-   if (rgba) {
-      sprp->sprite_collide = sprite_collide_alpha;
-   } else {
-      sprp->sprite_collide = sprite_collide_8bit;
+   if (sprp->spr_trans) {
+      return 1;
    }
 
    SDL_SetAlpha(spr, SDL_SRCALPHA | SDL_RLEACCEL, SDL_ALPHA_OPAQUE);
@@ -389,15 +602,16 @@ int sprite_load_from_png(struct sprite_t *sprp, const char *filename, bool trans
       WARN("SDL_DisplayFormatAlpha returned \"%s\"", SDL_GetError());
       return 0;
    }
-   if (!rgba) {
+   COUNT(Count_surfaces_created, 1);
+   if (spr->format->BytesPerPixel == 1) {
       /* If 8-bit, keep spr that way, sprite_rotozoom() is faster
        * for 8-bit but rgba has nicer edges.
        */
-      sprp->spr = spr;
    } else {
       /* Keep spr in displayformat for faster blits */
       sprp->spr = temp;
       SDL_FreeSurface(spr);
+      COUNT(Count_surfaces_freed, 1);
    }
    sprp->spr_trans = temp;
    if (SDL_MUSTLOCK(temp)) {
@@ -408,25 +622,57 @@ int sprite_load_from_png(struct sprite_t *sprp, const char *filename, bool trans
       SDL_UnlockSurface(temp);
    }
 
-   sprp->rect.x = 0;
-   sprp->rect.y = 0;
    sprp->rect.w = temp->w;
    sprp->rect.h = temp->h;
-   sprp->delta_w = 0;
-   sprp->delta_h = 0;
 
    return 1;
 }
 
 
+/**
+ * Load sprite from bitmap.
+ * @arg sprp Pointer to a struct sprite_t.
+ * @arg trans Is sprite transparent?
+ * @return 1 OK, 0 Error
+ */
+int sprite_load_from_png(struct sprite_t *sprp, const char *filename, bool trans)
+{
+   return sprite_decode_png(sprp, filename, trans) && sprite_display_format(sprp);
+}
+
+
+int sprite_reload_png(struct sprite_t *sprp, const char *filename, bool trans)
+{
+   return decode_png(sprp, filename, trans, false) && sprite_display_format(sprp);
+}
+
+
 void sprite_rotozoom(struct sprite_t *sprp, float angle, float zoom)
 {
+   TRACE_SCOPE("sprite_rotozoom");
+
+   if (rz_angle_step > 0) {
+      /* Round to the cache granularity, 1/64 steps for zoom */
+      angle = rz_angle_step * (int)(angle / rz_angle_step + (angle < 0 ? -0.5f : 0.5f));
+      zoom = (int)(zoom * 64 + 0.5f) / 64.0f;
+   }
+   /* Keep spr_trans if it already has this rotation */
+   if (sprp->rz_valid && sprp->rz_angle == angle && sprp->rz_zoom == zoom &&
+       sprp->rz_smooth == rz_smooth) {
+      return;
+   }
    /* Free previous spr_trans surface */
-   if (likely(sprp->spr_trans != sprp->spr) && sprp->spr_trans) {
+   if (likely(own_trans(sprp))) {
       SDL_FreeSurface((SDL_Surface *)sprp->spr_trans);
+      COUNT(Count_surfaces_freed, 1);
    }
+   drop_mask(sprp);
    /* Calculate radian angle and rotozoom */
-   sprp->spr_trans = rotozoomSurfaceXY(sprp->spr, angle * (2 * M_PI / 256.0f), zoom, zoom, 0);
+   sprp->spr_trans = rotozoomSurfaceXY(sprp->spr, angle * (2 * M_PI / 256.0f), zoom, zoom, rz_smooth);
+   sprp->rz_angle = angle;
+   sprp->rz_zoom = zoom;
+   sprp->rz_smooth = rz_smooth;
+   sprp->rz_valid = true;
    /* Save width and height of the rotated surface */
    sprp->rect.w = ((SDL_Surface *)sprp->spr_trans)->w;
    sprp->rect.h = ((SDL_Surface *)sprp->spr_trans)->h;
@@ -438,17 +684,109 @@ void sprite_rotozoom(struct sprite_t *sprp, float angle, float zoom)
 
 void sprite_reset(struct sprite_t *sprp)
 {
-   if (likely(sprp->spr_trans != sprp->spr)) {
+   if (sprp->spr_shared) {
+      /* Back to the shared surface, nothing to copy */
+      if (own_trans(sprp)) {
+         SDL_FreeSurface((SDL_Surface *)sprp->spr_trans);
+         COUNT(Count_surfaces_freed, 1);
+      }
+      sprp->spr_trans = sprp->spr_shared;
+   } else if (likely(sprp->spr_trans != sprp->spr)) {
       /* Free previous spr_trans surface */
       SDL_FreeSurface((SDL_Surface *)sprp->spr_trans);
+      COUNT(Count_surfaces_freed, 1);
       /* Make copy of spr with current displayformat */
       sprp->spr_trans = SDL_DisplayFormat(sprp->spr);
+      COUNT(Count_surfaces_created, 1);
    }
    sprp->rect.x = 0;
    sprp->rect.y = 0;
    sprite_reset_dimensions(*sprp);
    sprp->delta_w = 0;
    sprp->delta_h = 0;
+   sprp->rz_valid = false;
+   drop_mask(sprp);
+}
+
+
+void sprite_rotozoom_quality(bool smooth, float angle_step)
+{
+   rz_smooth = smooth ? SMOOTHING_ON : SMOOTHING_OFF;
+   rz_angle_step = angle_step;
+}
+
+
+void sprite_collide_masks(bool on)
+{
+   use_masks = on;
+}
+
+
+int sprite_tile(struct sprite_t *dst, struct sprite_t *src, int n)
+{
+   SDL_Surface *s = (SDL_Surface *)src->spr;
+   SDL_Surface *d;
+   SDL_Rect r = { 0, 0, s->w, s->h };
+   Uint32 flags = s->flags & (SDL_SRCALPHA | SDL_RLEACCEL);
+   int i;
+
+   d = SDL_CreateRGBSurface(SDL_SWSURFACE, s->w * n, s->h, s->format->BitsPerPixel,
+                            s->format->Rmask, s->format->Gmask,
+                            s->format->Bmask, s->format->Amask);
+   if (unlikely(!d)) {
+      WARN("SDL_CreateRGBSurface returned \"%s\"", SDL_GetError());
+      return 0;
+   }
+   COUNT(Count_surfaces_created, 1);
+   if (s->format->palette) {
+      SDL_SetColors(d, s->format->palette->colors, 0, s->format->palette->ncolors);
+   }
+   if (s->flags & SDL_SRCCOLORKEY) {
+      SDL_SetColorKey(d, SDL_SRCCOLORKEY, s->format->colorkey);
+   }
+
+   /* Copy pixels and alpha as they are, without blending */
+   SDL_SetAlpha(s, 0, SDL_ALPHA_OPAQUE);
+   for (i = 0; i < n; i++) {
+      r.x = i * s->w;
+      SDL_BlitSurface(s, NULL, d, &r);
+   }
+   SDL_SetAlpha(s, flags, SDL_ALPHA_OPAQUE);
+   SDL_SetAlpha(d, flags, SDL_ALPHA_OPAQUE);
+
+   memset(dst, 0, sizeof(*dst));
+   dst->spr = d;
+   dst->spr_trans = d;
+   dst->rect.w = d->w;
+   dst->rect.h = d->h;
+   dst->trans = src->trans;
+   dst->sprite_collide = src->sprite_collide;
+
+   return 1;
+}
+
+
+void sprite_share(struct sprite_t *dst, struct sprite_t *src)
+{
+   memset(dst, 0, sizeof(*dst));
+   dst->spr = src->spr;
+   dst->spr_trans = src->spr_trans;
+   dst->spr_shared = src->spr_trans;
+   dst->trans = src->trans;
+   dst->rect.w = ((SDL_Surface *)src->spr_trans)->w;
+   dst->rect.h = ((SDL_Surface *)src->spr_trans)->h;
+   dst->sprite_collide = src->sprite_collide;
+}
+
+
+void sprite_unshare(struct sprite_t *sprp)
+{
+   if (own_trans(sprp)) {
+      SDL_FreeSurface((SDL_Surface *)sprp->spr_trans);
+      COUNT(Count_surfaces_freed, 1);
+   }
+   drop_mask(sprp);
+   memset(sprp, 0, sizeof(*sprp));
 }
 
 
@@ -457,7 +795,11 @@ void sprite_blit_part(struct sprite_t *sprp, int sx, int sy, int dx, int dy, int
    SDL_Rect sr = { sx, sy, w, h };
    SDL_Rect dr = { dx, dy, w, h };
 
+   COUNT(Count_blits, 1);
    SDL_BlitSurface(sprp->spr, &sr, screen, &dr);
+   /* dr is clipped by the blit */
+   COUNT(Count_pixels_read, dr.w * dr.h);
+   COUNT(Count_pixels_written, dr.w * dr.h);
 }
 
 
@@ -466,7 +808,102 @@ void sprite_blit_part_dest(struct sprite_t *sprp, struct sprite_t *destp, int sx
    SDL_Rect sr = { sx, sy, w, h };
    SDL_Rect dr = { dx, dy, w, h };
 
+   COUNT(Count_blits, 1);
    SDL_BlitSurface(sprp->spr, &sr, destp->spr, &dr);
+   /* dr is clipped by the blit */
+   COUNT(Count_pixels_read, dr.w * dr.h);
+   COUNT(Count_pixels_written, dr.w * dr.h);
+}
+
+
+void sprite_inflate_embedded(void)
+{
+#ifdef EMBED_ASSETS
+   SDL_Thread *threads[INFLATE_MAX_THREADS];
+   struct inflate_job_t jobs[INFLATE_MAX_THREADS];
+   int n = 2;
+   int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+   n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (n > INFLATE_MAX_THREADS) {
+      n = INFLATE_MAX_THREADS;
+   }
+   if (n > NUM_EMBEDDED) {
+      n = NUM_EMBEDDED;
+   }
+   if (n < 1) {
+      n = 1;
+   }
+
+   for (i = 0; i < n; i++) {
+      jobs[i].first = i;
+      jobs[i].stride = n;
+      threads[i] = SDL_CreateThread(inflate_main, &jobs[i]);
+      if (!threads[i]) {
+         /* Do it here instead */
+         inflate_main(&jobs[i]);
+      }
+   }
+   for (i = 0; i < n; i++) {
+      if (threads[i]) {
+         SDL_WaitThread(threads[i], NULL);
+      }
+   }
+#endif
+}
+
+
+bool sprite_png_size(const char *filename, int *w, int *h)
+{
+   FILE *fp;
+   unsigned char buf[24];
+   bool ret = false;
+
+   if (!(fp = fopen(filename, "rb"))) {
+      perror(filename);
+      goto out;
+   }
+
+   /* Signature, IHDR chunk length and type, then big endian w and h */
+   if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) ||
+       png_sig_cmp(buf, 0, 8) || memcmp(buf + 12, "IHDR", 4)) {
+      WARN("%s is not a png file", filename);
+      goto out2;
+   }
+   *w = (buf[16] << 24) + (buf[17] << 16) + (buf[18] << 8) + buf[19];
+   *h = (buf[20] << 24) + (buf[21] << 16) + (buf[22] << 8) + buf[23];
+
+   ret = true;
+
+out2:
+
+   fclose(fp);
+
+out:
+
+   return ret;
+}
+
+
+size_t sprite_size(struct sprite_t *sprp)
+{
+   SDL_Surface *spr = (SDL_Surface *)sprp->spr;
+   SDL_Surface *trans = (SDL_Surface *)sprp->spr_trans;
+   size_t size = 0;
+
+   if (spr) {
+      size += spr->pitch * spr->h;
+   }
+   if (trans && trans != spr) {
+      size += trans->pitch * trans->h;
+   } else if (!trans && spr && spr->format->BytesPerPixel == 1) {
+      /* The display format copy sprite_display_format() will add */
+      size += spr->w * spr->h * 4;
+   }
+
+   return size;
 }
 
 
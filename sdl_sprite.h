@@ -56,6 +56,33 @@ struct sprite_t {
    int delta_w;
    int delta_h;
    bool (*sprite_collide)(struct sprite_t *sprp, int x, int y);
+   /* spr_trans is spr rotozoomed with these if rz_valid */
+   bool rz_valid;
+   float rz_angle;
+   float rz_zoom;
+   int rz_smooth;
+   /* Opaque pixels of spr_trans, made once it is hit tested often */
+   Uint8 *mask;
+   int mask_tests;
+   /* spr_trans of the sprite shared by sprite_share(), not freed */
+   void *spr_shared;
+};
+
+
+/* Zlib compressed surface, written by tools/pngembed and tools/png2h.sh.
+ * udata holds the inflated pixels after sprite_inflate_embedded().
+ */
+struct comp_surf_t {
+   int w, h, pitch;
+   /* 32 = RGBA, 8 = palette */
+   int bpp;
+   /* Palette, ncolors RGB triplets */
+   int ncolors;
+   const unsigned char *palette;
+   int ulen;
+   unsigned char *udata;
+   int clen;
+   unsigned char cdata[];
 };
 
 
@@ -65,11 +92,26 @@ struct sprite_t {
  */
 /* Set x, y coordinate of sprite */
 #define sprite_set_pos(s, xx, yy) { (s).rect.x = xx; (s).rect.y = yy; }
+/* Set position and the size of spr_trans, for sprites that are
+ * blitted again after a clipped blit may have shrunk the rect. */
+#define sprite_place(s, xx, yy) {                                       \
+      (s).rect.x = xx;                                                  \
+      (s).rect.y = yy;                                                  \
+      (s).rect.w = ((SDL_Surface *)(s).spr_trans)->w;                   \
+      (s).rect.h = ((SDL_Surface *)(s).spr_trans)->h;                   \
+   }
 #define sprite_width(s) (s).rect.w
 #define sprite_height(s) (s).rect.h
-/* Blit sprite to x, y (previously set by sprite_set_pos */
-#define sprite_blit(s) { SDL_BlitSurface((SDL_Surface *)(s).spr_trans, NULL, screen, &((s).rect)); }
-#define sprite_blit_dest(s,d) { SDL_BlitSurface((SDL_Surface *)(s).spr, NULL, (SDL_Surface *)(d).spr, &((s).rect)); }
+/* Blit sprite to x, y (previously set by sprite_set_pos. Pixels are
+ * counted from the rect SDL_BlitSurface clipped to the screen. */
+#define sprite_blit(s) {                                                \
+      TRACE_SCOPE("sprite_blit");                                       \
+      COUNT(Count_blits, 1);                                            \
+      SDL_BlitSurface((SDL_Surface *)(s).spr_trans, NULL, screen, &((s).rect)); \
+      COUNT(Count_pixels_read, (s).rect.w * (s).rect.h);                \
+      COUNT(Count_pixels_written, (s).rect.w * (s).rect.h);             \
+   }
+#define sprite_blit_dest(s,d) { COUNT(Count_blits, 1); SDL_BlitSurface((SDL_Surface *)(s).spr, NULL, (SDL_Surface *)(d).spr, &((s).rect)); }
 #define sprite_reset_dimensions(s) {                                    \
       (s).rect.w = ((SDL_Surface *)(s).spr)->w;                         \
       (s).rect.h = ((SDL_Surface *)(s).spr)->h;                         \
@@ -85,19 +127,74 @@ void sprite_free(struct sprite_t *s);
 
 
 /**
- * Load sprite from bitmap.
+ * Load sprite from bitmap, sprite_decode_png() followed by
+ * sprite_display_format().
  * @arg sprp Pointer to a struct sprite_t.
  * @arg trans Is sprite transparent?
- * @arg eightbit Set to true if sprite is going to be rotated later.
  * @return 1 OK, 0 Error
  */
 int sprite_load_from_png(struct sprite_t *sprp, const char *filename, bool trans);
 
+/**
+ * As sprite_load_from_png(), but always read the file, also when
+ * the png is built into the binary. For reloading edited pngs.
+ * @return 1 OK, 0 Error
+ */
+int sprite_reload_png(struct sprite_t *sprp, const char *filename, bool trans);
+
+/**
+ * Decode a png into a plain software surface. Does not look at the
+ * display, so it may run on other threads than the one drawing.
+ * @return 1 OK, 0 Error
+ */
+int sprite_decode_png(struct sprite_t *sprp, const char *filename, bool trans);
+
+/**
+ * Convert a sprite from sprite_decode_png() to the display format
+ * before it is blitted or rotozoomed. Call from the main thread only.
+ * Does nothing if already converted.
+ * @return 1 OK, 0 Error
+ */
+int sprite_display_format(struct sprite_t *sprp);
+
 /**
  * Rotate sprite angle deg (0-255).
  */
 void sprite_rotozoom(struct sprite_t *sprp, float angle, float zoom);
 
+/**
+ * Set rotozoom quality for all sprites. Angles are rounded to
+ * angle_step (0 = exact) so that repeated rotations are more
+ * likely to reuse the previous spr_trans.
+ */
+void sprite_rotozoom_quality(bool smooth, float angle_step);
+
+/**
+ * Hit test sprites that are tested often against a mask of their
+ * opaque pixels (default), or always read the pixel. Both give the
+ * same result.
+ */
+void sprite_collide_masks(bool on);
+
+/**
+ * Make dst a new sprite with n copies of src side by side.
+ * Free with sprite_free().
+ * @return 1 OK, 0 Error
+ */
+int sprite_tile(struct sprite_t *dst, struct sprite_t *src, int n);
+
+/**
+ * Make dst draw the surfaces of src, with a rotation and hit mask of
+ * its own. For many objects that look the same. src must outlive
+ * dst, which is freed with sprite_unshare(), not sprite_free().
+ */
+void sprite_share(struct sprite_t *dst, struct sprite_t *src);
+
+/**
+ * Free what a sprite from sprite_share() made itself.
+ */
+void sprite_unshare(struct sprite_t *sprp);
+
 /**
  * Reset sprite (only neccessary if sprite_rotozoom have been called).
  */
@@ -116,6 +213,25 @@ void sprite_blit_part(struct sprite_t *sprp, int sx, int sy, int dx, int dy, int
  */
 void sprite_blit_part_dest(struct sprite_t *sprp, struct sprite_t *destp, int sx, int sy, int dx, int dy, int w, int h);
 
+/**
+ * Inflate all png files built into the binary (EMBED=1 make), one
+ * thread per CPU. sprite_load_from_png() uses them instead of files.
+ * Does nothing in normal builds.
+ */
+void sprite_inflate_embedded(void);
+
+/**
+ * Read width and height from the header of a png file without
+ * decoding it.
+ * @return true OK, false Error
+ */
+bool sprite_png_size(const char *filename, int *w, int *h);
+
+/**
+ * Bytes of pixel memory used by sprite.
+ */
+size_t sprite_size(struct sprite_t *sprp);
+
 /**
  * GNU Emacs settings: K&R with 3 spaces indent.
  * Local Variables:
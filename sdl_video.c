@@ -37,6 +37,10 @@
  *
  ************************************************************************/
 
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
 #include "carnival.h"
 
 
@@ -51,11 +55,68 @@ Uint32 frames = 0;
  * "Private" variables
  * ----------------------------------------------
  */
+#define NSEC_PER_SEC 1000000000LL
+/* Frames closer than this to the period count as on time */
+#define JITTER_TOLERANCE_NS 200000LL
+/* Bounds for the spin time that ends each sleep */
+#define SPIN_MIN_NS 50000LL
+#define SPIN_MAX_NS 2000000LL
+
 static Uint32 fps = 60;
-static Uint32 ticks_start;
-static Uint32 ticks_old;
-static Uint32 ticks_slept = 0;
-static float ms_per_frame;
+static long long ns_per_frame;
+static long long ns_start;
+static long long ns_deadline;
+static long long ns_last;
+static long long ns_slept = 0;
+/* Calibrated at run time from how late clock_nanosleep wakes up */
+static long long ns_spin = 500000LL;
+
+/* Frame time statistics */
+static Uint32 jitter_frames = 0;
+static Uint32 jitter_ok = 0;
+static Uint32 jitter_resyncs = 0;
+static double jitter_sum = 0;
+static double jitter_sum2 = 0;
+static long long jitter_min = 0;
+static long long jitter_max = 0;
+
+/* Quality governor. Lower quality when the average time spent on
+ * a frame (not counting sleep) is above QUALITY_DOWN of the frame
+ * time for QUALITY_DOWN_FRAMES frames, raise it when below
+ * QUALITY_UP for QUALITY_UP_FRAMES.
+ */
+#define QUALITY_START 2
+#define QUALITY_AVG_FRAMES 30
+#define QUALITY_DOWN 0.85
+#define QUALITY_UP 0.50
+#define QUALITY_DOWN_FRAMES 30
+#define QUALITY_UP_FRAMES 180
+#define QUALITY_HISTORY 16
+
+struct quality_switch_t {
+   Uint32 frame;
+   int from;
+   int to;
+   double busy_ms;
+};
+
+static int quality = QUALITY_START;
+static bool quality_fixed = false;
+static double busy_avg = 0;
+static int quality_count = 0;
+static struct quality_switch_t quality_history[QUALITY_HISTORY];
+static int quality_switches = 0;
+
+/* Skipped frames */
+static Uint32 skipped = 0;
+static Uint32 skip_run = 0;
+static Uint32 skip_run_max = 0;
+
+/* Let SDL read window system events in a thread of its own */
+static bool event_thread = false;
+
+/* No window and no frame pacing */
+static bool headless = false;
 
 
 /* ----------------------------------------------
@@ -63,6 +124,107 @@ static float ms_per_frame;
  * ----------------------------------------------
  */
 
+/* Monotonic time in ns */
+static inline long long now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* Sleep until the monotonic time t (ns) */
+static void sleep_until(long long t)
+{
+#ifdef TIMER_ABSTIME
+   struct timespec ts;
+
+   ts.tv_sec = t / NSEC_PER_SEC;
+   ts.tv_nsec = t % NSEC_PER_SEC;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+      /* Interrupted by signal, sleep again */
+   }
+#else
+   long long wt = t - now_ns();
+
+   if (wt > 0) {
+      struct timespec ts = { wt / NSEC_PER_SEC, wt % NSEC_PER_SEC };
+      nanosleep(&ts, NULL);
+   }
+#endif
+}
+
+
+/* Record the length of a frame */
+static void jitter_add(long long ft)
+{
+   long long err = ft - ns_per_frame;
+
+   if (unlikely(jitter_frames == 0)) {
+      jitter_min = ft;
+      jitter_max = ft;
+   }
+   if (ft < jitter_min) {
+      jitter_min = ft;
+   }
+   if (ft > jitter_max) {
+      jitter_max = ft;
+   }
+   if (err >= -JITTER_TOLERANCE_NS && err <= JITTER_TOLERANCE_NS) {
+      jitter_ok++;
+   }
+   jitter_sum += (double)ft;
+   jitter_sum2 += (double)ft * (double)ft;
+   jitter_frames++;
+}
+
+
+static void quality_set(int q)
+{
+   struct quality_switch_t *qs;
+
+   if (quality_switches < QUALITY_HISTORY) {
+      qs = &quality_history[quality_switches];
+      qs->frame = frames;
+      qs->from = quality;
+      qs->to = q;
+      qs->busy_ms = busy_avg / 1000000.0;
+   }
+   quality_switches++;
+   quality = q;
+   quality_count = 0;
+}
+
+
+/* Feed the governor with the time spent on the last frame */
+static void quality_update(long long busy)
+{
+   /* A level load should not count as more than a slow frame */
+   if (busy > 2 * ns_per_frame) {
+      busy = 2 * ns_per_frame;
+   }
+   busy_avg += (busy - busy_avg) / QUALITY_AVG_FRAMES;
+   if (quality_fixed) {
+      return;
+   }
+
+   if (busy_avg > QUALITY_DOWN * ns_per_frame && quality > 0) {
+      quality_count = quality_count > 0 ? quality_count + 1 : 1;
+      if (quality_count >= QUALITY_DOWN_FRAMES) {
+         quality_set(quality - 1);
+      }
+   } else if (busy_avg < QUALITY_UP * ns_per_frame && quality < VIDEO_QUALITY_MAX) {
+      quality_count = quality_count < 0 ? quality_count - 1 : -1;
+      if (-quality_count >= QUALITY_UP_FRAMES) {
+         quality_set(quality + 1);
+      }
+   } else {
+      quality_count = 0;
+   }
+}
+
+
 /* This is a way of telling whether or not to use hardware surfaces
  * Copied from example code in the SDL sources.
  */
@@ -110,8 +272,19 @@ void video_init(int width, int height)
    Uint8  video_bpp = 0;
    Uint32 videoflags = SDL_SWSURFACE | SDL_ANYFORMAT /*| SDL_FULLSCREEN*/;
 
-   /* Initialize SDL */
-   if (unlikely(SDL_Init(SDL_INIT_VIDEO) < 0)) {
+   if (headless) {
+      /* Draw into a surface in memory, works without a display */
+      setenv("SDL_VIDEODRIVER", "dummy", 1);
+      event_thread = false;
+   }
+
+   /* Initialize SDL. Threaded events are not supported everywhere,
+    * fall back to pumping them from the main loop. */
+   if (event_thread && SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTTHREAD) < 0) {
+      WARN("SDL_INIT_EVENTTHREAD -> %s", SDL_GetError());
+      event_thread = false;
+   }
+   if (!event_thread && unlikely(SDL_Init(SDL_INIT_VIDEO) < 0)) {
       WARN("SDL_Init -> %s", SDL_GetError());
       exit(1);
    }
@@ -127,9 +300,41 @@ void video_init(int width, int height)
       exit(2);
    }
 
-   /* Init ticks counter vars */
-   ticks_start = SDL_GetTicks();
-   ticks_old = ticks_start;
+   /* Init frame pacer */
+   if (!ns_per_frame) {
+      video_set_preferred_framerate(fps);
+   }
+   ns_start = now_ns();
+   ns_last = ns_start;
+   ns_deadline = ns_start + ns_per_frame;
+}
+
+
+/* Call before video_init() */
+void video_headless(void)
+{
+   headless = true;
+}
+
+
+/* Call before video_init() */
+void video_event_thread(bool on)
+{
+   event_thread = on;
+}
+
+
+bool video_has_event_thread(void)
+{
+   return event_thread;
+}
+
+
+void video_fill_rect(int x, int y, int w, int h, Uint8 r, Uint8 g, Uint8 b)
+{
+   SDL_Rect rect = { x, y, w, h };
+
+   SDL_FillRect(screen, &rect, SDL_MapRGB(screen->format, r, g, b));
 }
 
 
@@ -137,45 +342,140 @@ void video_init(int width, int height)
 void video_set_preferred_framerate(int rate)
 {
    fps = rate;
-   ms_per_frame = 1000.0f / (double)fps;
+   ns_per_frame = NSEC_PER_SEC / fps;
+   ns_deadline = now_ns() + ns_per_frame;
 }
 
 
+/* Monotonic time in ns, for game logic */
+long long video_time_ns(void)
+{
+   return now_ns();
+}
+
+
+/* Wait for the end of the current frame.
+ *
+ * Frames end on absolute deadlines ns_per_frame apart, so rounding
+ * errors do not add up. Sleep in the kernel until ns_spin before the
+ * deadline and spin the rest of the way. ns_spin is kept at about
+ * twice the average time the kernel oversleeps.
+ */
 void video_fps_sleep(void)
 {
-   /* Delay execution to get approximately correct framerate */
-   int wt = (int)(ms_per_frame - (SDL_GetTicks() - ticks_old) + 0.5);
-   ticks_slept += wt;
-   /* Only sleep if wt is more than 5 ms */
-   if (likely(wt > 5)) {
-      /* Remove 2 ms to adjust for the extra sleep
-       * of SDL_Delay (due to OS scheduling).
-       */
-      SDL_Delay(wt - 2);
+   long long start = now_ns();
+   long long now, target;
+
+   if (unlikely(headless)) {
+      /* Next frame right away */
+      frames++;
+      ns_last = start;
+      return;
+   }
+
+   quality_update(start - ns_last);
+
+   if (likely(ns_deadline - start > ns_spin)) {
+      target = ns_deadline - ns_spin;
+      sleep_until(target);
+      ns_spin += (2 * (now_ns() - target) - ns_spin) / 8;
+      if (ns_spin < SPIN_MIN_NS) {
+         ns_spin = SPIN_MIN_NS;
+      } else if (ns_spin > SPIN_MAX_NS) {
+         ns_spin = SPIN_MAX_NS;
+      }
+   }
+   do {
+      now = now_ns();
+   } while (now < ns_deadline);
+
+   if (likely(ns_deadline > start)) {
+      ns_slept += now - start;
    }
    frames++;
-   ticks_old = SDL_GetTicks();
+   jitter_add(now - ns_last);
+   ns_last = now;
+
+   ns_deadline += ns_per_frame;
+   if (unlikely(ns_deadline <= now)) {
+      /* More than a frame late, start over instead of catching up */
+      ns_deadline = now + ns_per_frame;
+      jitter_resyncs++;
+   }
+   skip_run = 0;
 }
 
 
-/* Print average fps.
- * This will not work if the app has been running for more
- * than 49.7 days because the tick value will wrap around.
- */
+/* True if the deadline of the current frame has passed */
+bool video_frame_late(void)
+{
+   return !headless && now_ns() > ns_deadline;
+}
+
+
+/* Give up the current frame without drawing or sleeping */
+void video_skip_frame(void)
+{
+   skipped++;
+   if (++skip_run > skip_run_max) {
+      skip_run_max = skip_run;
+   }
+   ns_deadline += ns_per_frame;
+}
+
+
+int video_quality(void)
+{
+   return quality;
+}
+
+
+void video_fix_quality(int q)
+{
+   quality = q;
+   quality_fixed = true;
+}
+
+
+/* Print average fps, frame time jitter and quality switches */
 void video_average_fps(void)
 {
-   Uint32 now = SDL_GetTicks();
-   double fps_average = ((double)frames * 1000.0) / (double)(now - ticks_start);
-   double sleep_average_ms = ticks_slept / (double)frames;
-   double fps_average_ms = 1000.0 / fps_average;
-   if (likely(now > ticks_start)) {
-      printf("FPS: %2.2f\n", fps_average);
+   long long now = now_ns();
+   double ms_total = (now - ns_start) / 1000000.0;
+   double fps_average_ms, sleep_average_ms;
+   double mean, var;
+   int i;
+
+   if (likely(now > ns_start)) {
+      printf("FPS: %2.2f\n", frames * 1000.0 / ms_total);
    }
    if (likely(frames > 0)) {
+      fps_average_ms = ms_total / frames;
+      sleep_average_ms = ns_slept / 1000000.0 / frames;
       printf("Slept average %2.2f ms of total %2.2f ms each frame\n",
              sleep_average_ms, fps_average_ms);
       printf("Average CPU usage: %2.2f%%\n", 100.0 * (fps_average_ms - sleep_average_ms) / fps_average_ms);
    }
+   if (likely(jitter_frames > 0)) {
+      mean = jitter_sum / jitter_frames;
+      var = jitter_sum2 / jitter_frames - mean * mean;
+      printf("Frame time: mean %2.3f ms, stddev %2.3f ms, min %2.3f ms, max %2.3f ms\n",
+             mean / 1000000.0, (var > 0 ? sqrt(var) : 0) / 1000000.0,
+             jitter_min / 1000000.0, jitter_max / 1000000.0);
+      printf("Frames within %2.1f ms of %2.3f ms: %2.2f%% (%u late resyncs)\n",
+             JITTER_TOLERANCE_NS / 1000000.0, ns_per_frame / 1000000.0,
+             100.0 * jitter_ok / jitter_frames, jitter_resyncs);
+   }
+   if (unlikely(skipped > 0)) {
+      printf("Skipped %u frames, at most %u in a row\n", skipped, skip_run_max);
+   }
+   printf("Quality %d of %d%s, %d switches\n", quality, VIDEO_QUALITY_MAX,
+          quality_fixed ? " (fixed)" : "", quality_switches);
+   for (i = 0; i < quality_switches && i < QUALITY_HISTORY; i++) {
+      printf("  frame %u: %d -> %d (average work %2.2f ms)\n",
+             quality_history[i].frame, quality_history[i].from,
+             quality_history[i].to, quality_history[i].busy_ms);
+   }
 }
 
 
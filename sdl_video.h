@@ -57,6 +57,9 @@ extern Uint32 frames;
 /* Free sprite previously allocated by load_sprite_bmp */
 #define video_flip() { SDL_Flip(screen); }
 
+/* Quality tiers are 0 (fastest) .. VIDEO_QUALITY_MAX (best) */
+#define VIDEO_QUALITY_MAX 3
+
 
 /* ----------------------------------------------
  * Exported functions from video.c
@@ -64,8 +67,22 @@ extern Uint32 frames;
  */
 
 void video_init(int width, int height);
+/* Offscreen surface, no frame pacing, call before video_init */
+void video_headless(void);
+/* Ask for SDL_INIT_EVENTTHREAD, call before video_init */
+void video_event_thread(bool on);
+/* True if video_init got the event thread */
+bool video_has_event_thread(void);
 void video_set_preferred_framerate(int rate);
+void video_fill_rect(int x, int y, int w, int h, Uint8 r, Uint8 g, Uint8 b);
 void video_fps_sleep(void);
+bool video_frame_late(void);
+void video_skip_frame(void);
+/* Current quality tier, lowered when frames take too long */
+int video_quality(void);
+/* Use quality tier q and turn the governor off */
+void video_fix_quality(int q);
+long long video_time_ns(void);
 void video_average_fps(void);
 
 /**
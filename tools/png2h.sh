@@ -34,6 +34,9 @@ typedef unsigned char guint8;
 
 struct comp_surf_t {
    int w, h, pitch;
+   int bpp;
+   int ncolors;
+   const unsigned char *palette;
    int ulen;
    unsigned char *udata;
    int clen;
@@ -53,8 +56,8 @@ static void print_compressed(struct comp_surf_t *s, const char *name)
    comprlen = s->ulen;
    if (compress(s->udata, &comprlen, &PIXMAP[24], s->ulen) == Z_OK) {
       s->clen = (int)comprlen;
-      printf("static struct comp_surf_t %s = { %d, %d, %d, %d, NULL, %d, {\n   ",
-             name, s->w, s->h, s->pitch, s->ulen, s->clen);
+      printf("static struct comp_surf_t %s = { %d, %d, %d, %d, 0, NULL, %d, NULL, %d, {\n   ",
+             name, s->w, s->h, s->pitch, s->pitch / s->w * 8, s->ulen, s->clen);
       for (i = 0; i < s->clen - 1; i++) {
          printf("0x%02x, ", s->udata[i]);
          if (i % 12 == 11) {
@@ -0,0 +1,169 @@
+/*
+ * Convert png files to a C header with one zlib compressed
+ * struct comp_surf_t per file, and a table mapping file names
+ * to them. Used by the EMBED=1 build:
+ *
+ *   pngembed png/a.png png/b.png ... > assets.h
+ *
+ * Like sdl_load_png(), only 8bit RGBA and 8bpp palette png files
+ * are supported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <png.h>
+#include <zlib.h>
+
+
+static void print_bytes(const unsigned char *p, int len)
+{
+   int i;
+
+   printf("   ");
+   for (i = 0; i < len; i++) {
+      printf("0x%02x%s", p[i], i < len - 1 ? ", " : "\n");
+      if (i % 12 == 11 && i < len - 1) {
+         printf("\n   ");
+      }
+   }
+}
+
+
+/* png/left_mountain.png -> asset_left_mountain */
+static void make_name(char *name, int size, const char *filename)
+{
+   const char *p = strrchr(filename, '/');
+   int i;
+
+   p = p ? p + 1 : filename;
+   i = snprintf(name, size, "asset_");
+   for (; *p && *p != '.' && i < size - 1; p++, i++) {
+      name[i] = isalnum((unsigned char)*p) ? *p : '_';
+   }
+   name[i] = '\0';
+}
+
+
+static int embed(const char *filename, const char *name)
+{
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytepp row_pointers;
+   png_colorp palette;
+   int num_palette = 0;
+   png_byte bit_depth, color_type;
+   int w, h, pitch, y;
+   unsigned char *udata, *cdata;
+   unsigned long clen;
+   /* volatile, png errors longjmp back here */
+   volatile int ret = 0;
+
+   if (!(fp = fopen(filename, "rb"))) {
+      perror(filename);
+      return 0;
+   }
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   info_ptr = png_create_info_struct(png_ptr);
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      fprintf(stderr, "%s: png error\n", filename);
+      goto out;
+   }
+   png_init_io(png_ptr, fp);
+   png_read_png(png_ptr, info_ptr, 0, NULL);
+
+   bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+   color_type = png_get_color_type(png_ptr, info_ptr);
+   if (!(bit_depth == 8 && (color_type == PNG_COLOR_TYPE_RGBA ||
+                            color_type == PNG_COLOR_TYPE_PALETTE))) {
+      fprintf(stderr, "%s: skipped, only 8bit RGBA or 8bpp PALETTE supported\n", filename);
+      goto out;
+   }
+
+   w = png_get_image_width(png_ptr, info_ptr);
+   h = png_get_image_height(png_ptr, info_ptr);
+   pitch = png_get_rowbytes(png_ptr, info_ptr);
+   row_pointers = png_get_rows(png_ptr, info_ptr);
+
+   udata = (unsigned char *)malloc(pitch * h);
+   clen = compressBound(pitch * h);
+   cdata = (unsigned char *)malloc(clen);
+   if (!udata || !cdata) {
+      perror("malloc");
+      exit(1);
+   }
+   for (y = 0; y < h; y++) {
+      memcpy(udata + y * pitch, row_pointers[y], pitch);
+   }
+   if (compress2(cdata, &clen, udata, pitch * h, Z_BEST_COMPRESSION) != Z_OK) {
+      fprintf(stderr, "%s: compress2 failed\n", filename);
+      exit(1);
+   }
+
+   if (color_type == PNG_COLOR_TYPE_PALETTE) {
+      png_get_PLTE(png_ptr, info_ptr, &palette, &num_palette);
+      printf("static const unsigned char %s_pal[] = {\n", name);
+      print_bytes((const unsigned char *)palette, num_palette * 3);
+      printf("};\n");
+   }
+
+   printf("static struct comp_surf_t %s = { %d, %d, %d, %d, %d, %s%s, %d, NULL, %d, {\n",
+          name, w, h, pitch, color_type == PNG_COLOR_TYPE_PALETTE ? 8 : 32,
+          num_palette, num_palette ? name : "NULL", num_palette ? "_pal" : "",
+          pitch * h, (int)clen);
+   print_bytes(cdata, clen);
+   printf("   }\n};\n\n");
+
+   free(cdata);
+   free(udata);
+   ret = 1;
+
+out:
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+   fclose(fp);
+
+   return ret;
+}
+
+
+int main(int argc, char *argv[])
+{
+   int i;
+   char name[64];
+   char *done;
+
+   if (argc < 2) {
+      fprintf(stderr, "Usage: %s <png files> > assets.h\n", argv[0]);
+      return 1;
+   }
+
+   done = (char *)calloc(argc, 1);
+   if (!done) {
+      perror("calloc");
+      return 1;
+   }
+
+   printf("/* Generated by tools/pngembed from png files, do not edit. */\n\n");
+
+   for (i = 1; i < argc; i++) {
+      make_name(name, sizeof(name), argv[i]);
+      done[i] = embed(argv[i], name);
+   }
+
+   printf("static struct embedded_t embedded[] = {\n");
+   for (i = 1; i < argc; i++) {
+      if (done[i]) {
+         make_name(name, sizeof(name), argv[i]);
+         printf("   { \"%s\", &%s },\n", argv[i], name);
+      }
+   }
+   printf("   { NULL, NULL }\n};\n");
+
+   free(done);
+
+   return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+# Print, as CSV, how the time of moving targets, drawing and hit
+# testing grows with live targets, layers, target size and motion.
+# Each line plays a stress level made by tools/stresslevel headless
+# for FRAMES frames with CLICKS aimed clicks hit tested per frame.
+#
+#   tools/scaling.sh [frames] [clicks] > scaling.csv
+#
+# Run from the top directory, make scaling builds what it needs.
+
+FRAMES=${1:-600}
+CLICKS=${2:-1000}
+DIR=stress
+
+usage () {
+    echo "Usage: scaling.sh [frames] [clicks]"
+}
+
+if ! test -x ./carnival -a -x ./tools/stresslevel; then
+    usage
+    echo "  run from the top directory after make carnival tools/stresslevel"
+    exit 1
+fi
+
+# run <axis> <value> <stresslevel options>...
+run () {
+    AXIS=$1
+    VALUE=$2
+    shift 2
+    ./tools/stresslevel "$@" $DIR > /dev/null || exit 1
+    OUT=`./carnival -d $DIR -S 1 -b $FRAMES -C $CLICKS -D seek` || exit 1
+    # Phase lines: name, runs, total (ms), per second
+    MOVE=`echo "$OUT" | awk '$1 == "move_targets" && NF == 4 { printf "%.1f", $3 * 1000 / $2 }'`
+    DRAW=`echo "$OUT" | awk '$1 == "draw_layers" && NF == 4 { printf "%.1f", $3 * 1000 / $2 }'`
+    # CLICKS: <path>, <n> M hit tests/s, <ns> ns each
+    PIXELS=`echo "$OUT" | awk '$2 == "pixels," { print $(NF - 2) }'`
+    MASKS=`echo "$OUT" | awk '$2 == "masks," { print $(NF - 2) }'`
+    echo "$AXIS,$VALUE,$MOVE,$DRAW,$PIXELS,$MASKS"
+}
+
+echo "axis,value,move_us,draw_us,hit_pixels_ns,hit_masks_ns"
+for N in 10 100 1000 10000; do
+    run targets $N -t $N
+done
+for N in 0 1 2 3 4 5 6 7 8 9; do
+    run layers $N -l $N
+done
+for Z in 0.25 0.5 1 1.5 2 3 4; do
+    run zoom $Z -z $Z
+done
+for M in horizontal pendulum pending; do
+    run motion $M -m $M
+done
@@ -0,0 +1,387 @@
+/*
+ * Write a stress level for scaling tests, made from a template level
+ * with other motion, target sprite sizes and numbers of targets and
+ * layers:
+ *
+ *   stresslevel [-T <template>] [-t <targets>] [-l <layers>] [-z <zoom>]
+ *               [-m horizontal|pendulum|pending|mixed] [-s <seed>] <dir>
+ *
+ * writes <dir>/level1.txt and the pngs it needs into <dir>, to be
+ * played with carnival -d <dir> from the top directory. The targets
+ * are split over the kinds that spawn by themselves, with count, the
+ * bonus target is left as it is. The level format has a fixed number
+ * of layers, so the ones left out are a 1x1 clear png.
+ *
+ * Like sdl_load_png(), only 8bit RGBA and 8bpp palette png files
+ * are supported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <png.h>
+
+/* As in level.h */
+#define NUM_TARGETS 7
+#define LEVEL_MAX_COUNT 10000
+#define LEVEL_PNG_LEN 64
+/* Layers other than the background */
+#define NUM_LAYERS 9
+
+enum motion_t {
+   Horizontal,
+   Pendulum,
+   Pending,
+   Mixed
+};
+
+static const char *motions[] = { "horizontal", "pendulum", "pending", "mixed" };
+
+
+static void usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [-T <template>] [-t <targets>] [-l <layers>] [-z <zoom>]\n"
+           "          [-m horizontal|pendulum|pending|mixed] [-s <seed>] <dir>\n", name);
+   fprintf(stderr, "  -T  Level to start from (default levels/level1.txt)\n");
+   fprintf(stderr, "  -t  Targets that can live at the same time, besides the bonus target,\n"
+           "      1-%d (default as in the template)\n", (NUM_TARGETS - 1) * LEVEL_MAX_COUNT);
+   fprintf(stderr, "  -l  Layers drawn besides the background, 0-%d (default %d)\n",
+           NUM_LAYERS, NUM_LAYERS);
+   fprintf(stderr, "  -z  Size of target sprites (default 1)\n");
+   fprintf(stderr, "  -m  How targets move (default as in the template)\n");
+   fprintf(stderr, "  -s  Seed for mixed motion\n");
+}
+
+
+/**
+ * Write the w x h image in rows as a png file of color_type, with
+ * the palette of src_png/src_info if it is PNG_COLOR_TYPE_PALETTE.
+ */
+static int write_png(const char *filename, png_bytepp rows, int w, int h,
+                     int color_type, png_structp src_png, png_infop src_info)
+{
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_colorp palette;
+   int num_palette;
+   png_bytep trans;
+   int num_trans;
+   png_color_16p trans_color;
+   /* volatile, png errors longjmp back here */
+   volatile int ret = 0;
+
+   if (!(fp = fopen(filename, "wb"))) {
+      perror(filename);
+      return 0;
+   }
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   info_ptr = png_create_info_struct(png_ptr);
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      fprintf(stderr, "%s: png error\n", filename);
+      goto out;
+   }
+   png_init_io(png_ptr, fp);
+   png_set_IHDR(png_ptr, info_ptr, w, h, 8, color_type, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+   if (color_type == PNG_COLOR_TYPE_PALETTE) {
+      png_get_PLTE(src_png, src_info, &palette, &num_palette);
+      png_set_PLTE(png_ptr, info_ptr, palette, num_palette);
+      if (png_get_tRNS(src_png, src_info, &trans, &num_trans, &trans_color)) {
+         png_set_tRNS(png_ptr, info_ptr, trans, num_trans, trans_color);
+      }
+   }
+   png_set_rows(png_ptr, info_ptr, rows);
+   png_write_png(png_ptr, info_ptr, 0, NULL);
+   ret = 1;
+
+out:
+
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   fclose(fp);
+
+   return ret;
+}
+
+
+/* Write src scaled by zoom to dst, nearest neighbour */
+static int scale_png(const char *src, const char *dst, float zoom)
+{
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytepp rows, srows;
+   png_byte bit_depth, color_type;
+   int w, h, sw, sh, bpp, x, y, i;
+   /* volatile, png errors longjmp back here */
+   volatile int ret = 0;
+
+   if (!(fp = fopen(src, "rb"))) {
+      perror(src);
+      return 0;
+   }
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   info_ptr = png_create_info_struct(png_ptr);
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      fprintf(stderr, "%s: png error\n", src);
+      goto out;
+   }
+   png_init_io(png_ptr, fp);
+   png_read_png(png_ptr, info_ptr, 0, NULL);
+
+   bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+   color_type = png_get_color_type(png_ptr, info_ptr);
+   if (!(bit_depth == 8 && (color_type == PNG_COLOR_TYPE_RGBA ||
+                            color_type == PNG_COLOR_TYPE_PALETTE))) {
+      fprintf(stderr, "%s: only 8bit RGBA or 8bpp PALETTE supported\n", src);
+      goto out;
+   }
+   bpp = color_type == PNG_COLOR_TYPE_RGBA ? 4 : 1;
+
+   sw = png_get_image_width(png_ptr, info_ptr);
+   sh = png_get_image_height(png_ptr, info_ptr);
+   srows = png_get_rows(png_ptr, info_ptr);
+   w = sw * zoom + 0.5f;
+   h = sh * zoom + 0.5f;
+   if (w < 1) {
+      w = 1;
+   }
+   if (h < 1) {
+      h = 1;
+   }
+
+   rows = (png_bytepp)malloc(h * sizeof(png_bytep));
+   if (!rows) {
+      perror("malloc");
+      exit(1);
+   }
+   for (y = 0; y < h; y++) {
+      rows[y] = (png_bytep)malloc(w * bpp);
+      if (!rows[y]) {
+         perror("malloc");
+         exit(1);
+      }
+      for (x = 0; x < w; x++) {
+         for (i = 0; i < bpp; i++) {
+            rows[y][x * bpp + i] = srows[y * sh / h][(x * sw / w) * bpp + i];
+         }
+      }
+   }
+   ret = write_png(dst, rows, w, h, color_type, png_ptr, info_ptr);
+
+   for (y = 0; y < h; y++) {
+      free(rows[y]);
+   }
+   free(rows);
+
+out:
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+   fclose(fp);
+
+   return ret;
+}
+
+
+/* Write a 1x1 clear png */
+static int empty_png(const char *dst)
+{
+   png_byte pixel[4] = { 0, 0, 0, 0 };
+   png_bytep rows[1] = { pixel };
+
+   return write_png(dst, rows, 1, 1, PNG_COLOR_TYPE_RGBA, NULL, NULL);
+}
+
+
+/* dir/name of path, exits if it is too long for a level file */
+static void out_path(char *buf, const char *dir, const char *path)
+{
+   const char *p = strrchr(path, '/');
+
+   p = p ? p + 1 : path;
+   if (snprintf(buf, LEVEL_PNG_LEN, "%s/%s", dir, p) >= LEVEL_PNG_LEN) {
+      fprintf(stderr, "%s/%s: longer than %d\n", dir, p, LEVEL_PNG_LEN - 1);
+      exit(1);
+   }
+}
+
+
+static int round_int(float v)
+{
+   return v < 0 ? (int)(v - 0.5f) : (int)(v + 0.5f);
+}
+
+
+/**
+ * Change the value of key in a target section of the level, for
+ * zoom and motion move (-1 = as it is). Return 0 on error.
+ */
+static int target_value(const char *key, char *value, int size, const char *dir,
+                        float zoom, int move)
+{
+   char path[LEVEL_PNG_LEN];
+
+   if (strcmp(key, "sprite") == 0 && zoom != 1.0f) {
+      out_path(path, dir, value);
+      if (!scale_png(value, path, zoom)) {
+         return 0;
+      }
+      snprintf(value, size, "%s", path);
+   } else if (strcmp(key, "targ_x") == 0 || strcmp(key, "targ_y") == 0 ||
+              strcmp(key, "flag_x") == 0 || strcmp(key, "flag_y") == 0) {
+      snprintf(value, size, "%d", round_int(atof(value) * zoom));
+   } else if (strncmp(key, "targ_r_", 7) == 0) {
+      /* Radii are squared */
+      snprintf(value, size, "%d", round_int(atof(value) * zoom * zoom));
+   } else if (move < 0) {
+      return 1;
+   } else if (strcmp(key, "horizontal") == 0) {
+      snprintf(value, size, "%s", move == Horizontal ? "true" : "false");
+   } else if (strcmp(key, "pending") == 0) {
+      snprintf(value, size, "%s", move == Pendulum ? "true" : "false");
+   } else if (strcmp(key, "hor_pending") == 0) {
+      snprintf(value, size, "%s", move == Pending ? "true" : "false");
+   } else if (atof(value) == 0) {
+      /* Make targets that didn't move this way move */
+      if (move == Horizontal && strcmp(key, "hor_speed") == 0) {
+         snprintf(value, size, "1.0");
+      } else if (move == Pendulum && strcmp(key, "pend_fi_amp") == 0) {
+         snprintf(value, size, "20");
+      } else if (move == Pendulum && strcmp(key, "pend_fi_c") == 0) {
+         snprintf(value, size, "1.3");
+      } else if (move == Pendulum && strcmp(key, "pend_l") == 0) {
+         snprintf(value, size, "100");
+      } else if (move == Pending && strcmp(key, "hor_pend_amp") == 0) {
+         snprintf(value, size, "100");
+      } else if (move == Pending && strcmp(key, "hor_pend_c") == 0) {
+         snprintf(value, size, "2");
+      }
+   }
+
+   return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+   const char *template = "levels/level1.txt";
+   const char *dir = NULL;
+   int targets = -1;
+   int layers = NUM_LAYERS;
+   float zoom = 1.0f;
+   int motion = -1;
+   unsigned int seed = 1;
+   char filename[LEVEL_PNG_LEN];
+   char empty[LEVEL_PNG_LEN];
+   char line[256], key[64], value[192];
+   char *p;
+   FILE *in, *out;
+   int i, len;
+   int target = -1, layer = 0, move = -1;
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+         template = argv[++i];
+      } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+         targets = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+         layers = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+         zoom = atof(argv[++i]);
+      } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+         i++;
+         for (motion = Mixed; motion >= 0 && strcmp(argv[i], motions[motion]); motion--);
+         if (motion < 0) {
+            usage(argv[0]);
+            return 1;
+         }
+      } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+         seed = strtoul(argv[++i], NULL, 0);
+      } else if (argv[i][0] != '-' && !dir) {
+         dir = argv[i];
+      } else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (!dir || targets == 0 || targets > (NUM_TARGETS - 1) * LEVEL_MAX_COUNT ||
+       layers < 0 || layers > NUM_LAYERS || zoom <= 0) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+      perror(dir);
+      return 1;
+   }
+   out_path(empty, dir, "empty.png");
+   if (layers < NUM_LAYERS && !empty_png(empty)) {
+      return 1;
+   }
+   if (!(in = fopen(template, "r"))) {
+      perror(template);
+      return 1;
+   }
+   out_path(filename, dir, "level1.txt");
+   if (!(out = fopen(filename, "w"))) {
+      perror(filename);
+      return 1;
+   }
+
+   srand(seed);
+   fprintf(out, "# Made by tools/stresslevel from %s:\n", template);
+   if (targets < 0) {
+      fprintf(out, "# template targets, ");
+   } else {
+      fprintf(out, "# %d targets, ", targets);
+   }
+   fprintf(out, "%d layers, zoom %.2f, %s motion\n\n", layers,
+           zoom, motion < 0 ? "template" : motions[motion]);
+
+   while (fgets(line, sizeof(line), in)) {
+      p = line + strspn(line, " \t");
+      if (strncmp(p, "[target]", 8) == 0) {
+         target++;
+         move = motion == Mixed ? rand() % Mixed : motion;
+      }
+      if (*p == '[' || sscanf(p, "%63[^ \t=] = %191[^ \t#\n]", key, value) != 2) {
+         /* Section, comment or empty line */
+         fputs(line, out);
+         if (*p == '[' && target >= 0 && target < NUM_TARGETS - 1 && targets > 0) {
+            /* The first targets % kinds get one more */
+            fprintf(out, "count = %d\n", targets / (NUM_TARGETS - 1) +
+                    (target < targets % (NUM_TARGETS - 1)));
+         }
+         continue;
+      }
+      if (target >= 0 && target < NUM_TARGETS - 1 && targets > 0 &&
+          strcmp(key, "count") == 0) {
+         /* Replaced above */
+         continue;
+      }
+      if (target < 0) {
+         /* Layers before the background are left out from the end */
+         len = strlen(key);
+         if (len > 2 && strcmp(key + len - 2, "_s") == 0 &&
+             strcmp(key, "background_s") != 0 && layer++ >= layers) {
+            snprintf(value, sizeof(value), "%s", empty);
+         }
+      } else if (!target_value(key, value, sizeof(value), dir, zoom, move)) {
+         return 1;
+      }
+      fprintf(out, "%s = %s\n", key, value);
+   }
+
+   fclose(in);
+   if (fclose(out) != 0) {
+      perror(filename);
+      return 1;
+   }
+   printf("%s\n", filename);
+
+   return 0;
+}